@@ -0,0 +1,223 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <QVector>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <CGAL/convex_hull_3.h>
+#include <CGAL/Polyhedron_3.h>
+
+/// Akl-Toussaint heuristic, in 3D: the points farthest along a set of
+/// directions span a polytope inside of the hull, and the points strictly
+/// inside of that polytope can't be on the hull. Dropping them first leaves
+/// CGAL::convex_hull_3 with a thin shell of the input. Both passes (finding
+/// the extremes, testing the points) run on chunks of the points in parallel.
+///
+/// The hull does not change: a point is dropped only if it is inside of every
+/// facet plane of the polytope by a margin far above the rounding error of
+/// the test, every doubtful point is kept. Survivors keep their input order.
+///
+/// Use: ExtremePointCulling<K>()(points.begin(), points.end(), survivors);
+template <class Kernel>
+class ExtremePointCulling{
+public:
+    typedef typename Kernel::Point_3 Point_3;
+
+    /// Appends the points of [begin,end) that may be on the hull to survivors
+    /// (all of them if there are too few, or if they are flat)
+    /// @note Iterator is random access, dereferences to a Point_3
+    template <class Iterator>
+    void operator()(Iterator begin, Iterator end, std::vector<Point_3>& survivors){
+        size_t count = end - begin;
+        _culled = 0;
+        if(count < MIN_POINTS){
+            survivors.insert(survivors.end(), begin, end);
+            return;
+        }
+
+        /// Chunks, a few per core so that they even out
+        QVector<Chunk> chunks;
+        size_t size = std::max<size_t>(MIN_CHUNK, count/(4*QThread::idealThreadCount()) + 1);
+        for(size_t first=0; first<count; first+=size)
+            chunks.push_back( Chunk(first, std::min(count, first+size)) );
+
+        /// Farthest points along the directions, in each chunk then overall
+        QtConcurrent::blockingMap(chunks, FindExtremes<Iterator>(begin));
+        std::vector<size_t> extremes;
+        for(int d=0; d<2*AXES; d++){
+            const Chunk* best = &chunks[0];
+            for(int c=1; c<chunks.size(); c++)
+                if(chunks[c].value[d] > best->value[d]) best = &chunks[c];
+            extremes.push_back(best->extreme[d]);
+        }
+        std::sort(extremes.begin(), extremes.end());
+        extremes.erase(std::unique(extremes.begin(), extremes.end()), extremes.end());
+
+        if(!build_polytope(begin, extremes)){
+            survivors.insert(survivors.end(), begin, end);
+            return;
+        }
+
+        /// Test the points, then gather the survivors in order
+        QtConcurrent::blockingMap(chunks, KeepOutside<Iterator>(begin, _planes));
+        size_t kept = 0;
+        for(int c=0; c<chunks.size(); c++)
+            kept += chunks[c].kept.size();
+        survivors.reserve(survivors.size() + kept);
+        for(int c=0; c<chunks.size(); c++)
+            survivors.insert(survivors.end(), chunks[c].kept.begin(), chunks[c].kept.end());
+        _culled = count - kept;
+    }
+
+    /// Points dropped by the last call
+    size_t culled() const { return _culled; }
+
+private:
+    /// Below this, CGAL is faster on its own
+    enum{ MIN_POINTS = 10000, MIN_CHUNK = 4096 };
+    /// The 13 axes through the faces, edges and corners of a cube, each
+    /// gives two directions (26 extremes at most)
+    enum{ AXES = 13 };
+    static const double* axis(int a){
+        static const double axes[AXES][3] = {
+            {1,0,0}, {0,1,0}, {0,0,1},
+            {1,1,0}, {1,-1,0}, {1,0,1}, {1,0,-1}, {0,1,1}, {0,1,-1},
+            {1,1,1}, {1,1,-1}, {1,-1,1}, {1,-1,-1} };
+        return axes[a];
+    }
+
+    /// A facet plane of the polytope, n.p + d < -margin is strictly inside
+    struct Plane{ double n[3], d, margin; };
+
+    struct Chunk{
+        Chunk(){}
+        Chunk(size_t begin, size_t end) : begin(begin), end(end){}
+        size_t begin, end;
+        /// Direction 2a is +axis(a), 2a+1 is -axis(a)
+        size_t extreme[2*AXES];
+        double value[2*AXES];
+        std::vector<Point_3> kept;
+    };
+
+    template <class Iterator>
+    struct FindExtremes{
+        typedef void result_type;
+        FindExtremes(Iterator points) : points(points){}
+        void operator()(Chunk& chunk) const {
+            for(int d=0; d<2*AXES; d++){
+                chunk.extreme[d] = chunk.begin;
+                chunk.value[d] = -HUGE_VAL;
+            }
+            for(size_t i=chunk.begin; i<chunk.end; i++){
+                const Point_3& p = points[i];
+                double x = CGAL::to_double(p.x()), y = CGAL::to_double(p.y()), z = CGAL::to_double(p.z());
+                for(int a=0; a<AXES; a++){
+                    const double* u = axis(a);
+                    double dot = u[0]*x + u[1]*y + u[2]*z;
+                    if( dot > chunk.value[2*a]){   chunk.value[2*a] = dot;    chunk.extreme[2*a] = i; }
+                    if(-dot > chunk.value[2*a+1]){ chunk.value[2*a+1] = -dot; chunk.extreme[2*a+1] = i; }
+                }
+            }
+        }
+        Iterator points;
+    };
+
+    template <class Iterator>
+    struct KeepOutside{
+        typedef void result_type;
+        KeepOutside(Iterator points, const std::vector<Plane>& planes) : points(points), planes(planes){}
+        void operator()(Chunk& chunk) const {
+            chunk.kept.clear();
+            for(size_t i=chunk.begin; i<chunk.end; i++){
+                const Point_3& p = points[i];
+                double x = CGAL::to_double(p.x()), y = CGAL::to_double(p.y()), z = CGAL::to_double(p.z());
+                bool inside = true;
+                for(size_t f=0; inside && f<planes.size(); f++){
+                    const Plane& plane = planes[f];
+                    inside = plane.n[0]*x + plane.n[1]*y + plane.n[2]*z + plane.d < -plane.margin;
+                }
+                if(!inside) chunk.kept.push_back(p);
+            }
+        }
+        Iterator points;
+        const std::vector<Plane>& planes;
+    };
+
+    /// Fills _planes with the facets of the hull of the extremes, false if
+    /// they are flat (no interior to cull with)
+    template <class Iterator>
+    bool build_polytope(Iterator points, const std::vector<size_t>& indices){
+        std::vector<Point_3> extremes;
+        for(size_t i=0; i<indices.size(); i++)
+            extremes.push_back(points[indices[i]]);
+        if(!spans_volume(extremes)) return false;
+
+        typedef CGAL::Polyhedron_3<Kernel> Polytope;
+        Polytope polytope;
+        CGAL::convex_hull_3(extremes.begin(), extremes.end(), polytope);
+
+        /// A bound on the coordinates of every point (the extremes include
+        /// the ones along the axes)
+        double bound = 0;
+        for(typename Polytope::Vertex_iterator v=polytope.vertices_begin(); v!=polytope.vertices_end(); v++)
+            for(int k=0; k<3; k++)
+                bound = std::max(bound, std::fabs(CGAL::to_double(v->point()[k])));
+
+        _planes.clear();
+        for(typename Polytope::Facet_iterator f=polytope.facets_begin(); f!=polytope.facets_end(); f++){
+            typename Polytope::Halfedge_handle h = f->halfedge();
+            const Point_3& p = h->vertex()->point();
+            const Point_3& q = h->next()->vertex()->point();
+            const Point_3& r = h->next()->next()->vertex()->point();
+            double o[3], u[3], v[3];
+            for(int k=0; k<3; k++){
+                o[k] = CGAL::to_double(p[k]);
+                u[k] = CGAL::to_double(q[k]) - o[k];
+                v[k] = CGAL::to_double(r[k]) - o[k];
+            }
+            Plane plane;
+            plane.n[0] = u[1]*v[2] - u[2]*v[1];
+            plane.n[1] = u[2]*v[0] - u[0]*v[2];
+            plane.n[2] = u[0]*v[1] - u[1]*v[0];
+            plane.d = -(plane.n[0]*o[0] + plane.n[1]*o[1] + plane.n[2]*o[2]);
+
+            /// Outward, decided exactly by a vertex off the facet. The
+            /// rounded normal must agree, or the polytope is too thin to trust
+            typename Polytope::Vertex_iterator s = polytope.vertices_begin();
+            while(s!=polytope.vertices_end() && CGAL::orientation(p, q, r, s->point())==CGAL::COPLANAR) s++;
+            if(s==polytope.vertices_end()) return false;
+            double side = 0;
+            for(int k=0; k<3; k++)
+                side += plane.n[k] * (CGAL::to_double(s->point()[k]) - o[k]);
+            bool positive = CGAL::orientation(p, q, r, s->point())==CGAL::POSITIVE;
+            if(positive != (side>0)) return false;
+            if(positive){
+                for(int k=0; k<3; k++) plane.n[k] = -plane.n[k];
+                plane.d = -plane.d;
+            }
+            /// The rounding errors of n and of the test are a few ulps of
+            /// |u||v| times the coordinates: far below this margin
+            double span = (std::fabs(u[0]) + std::fabs(u[1]) + std::fabs(u[2]))
+                        * (std::fabs(v[0]) + std::fabs(v[1]) + std::fabs(v[2]));
+            plane.margin = 1e-10 * span * bound;
+            _planes.push_back(plane);
+        }
+        return true;
+    }
+
+    /// True if 4 of the points are not coplanar (exact predicates)
+    static bool spans_volume(const std::vector<Point_3>& points){
+        if(points.size() < 4) return false;
+        size_t i = 1;
+        while(i<points.size() && points[i]==points[0]) i++;
+        size_t j = i+1;
+        while(j<points.size() && CGAL::collinear(points[0], points[i], points[j])) j++;
+        size_t k = j+1;
+        while(k<points.size() && CGAL::coplanar(points[0], points[i], points[j], points[k])) k++;
+        return k < points.size();
+    }
+
+    std::vector<Plane> _planes;
+    size_t _culled;
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <QVector>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <CGAL/convex_hull_3.h>
+#include <CGAL/Polyhedron_3.h>
+
+/// Convex hull of many points on all cores, by divide and conquer: the points
+/// are split into slabs along their longest axis, the slabs are hulled
+/// concurrently, and the hull of the vertices of these hulls is the hull of
+/// all the points. Every step is CGAL::convex_hull_3, with the exact
+/// predicates of the kernel, so the hull has the same vertices as the one
+/// computed in one go. Only the last step (a much smaller input) is serial.
+///
+/// Use: ParallelConvexHull<K>()(points, poly);
+template <class Kernel>
+class ParallelConvexHull{
+public:
+    typedef typename Kernel::Point_3 Point_3;
+
+    /// Hull of points into poly (cleared first)
+    /// @note reorders points
+    template <class Polyhedron>
+    void operator()(std::vector<Point_3>& points, Polyhedron& poly, int parts=QThread::idealThreadCount()){
+        poly.clear();
+        parts = std::min<int>(parts, points.size()/MIN_PART);
+        if(parts < 2){
+            CGAL::convex_hull_3(points.begin(), points.end(), poly);
+            return;
+        }
+
+        /// Slabs of about the same size, along the longest axis
+        QVector<Slab> slabs;
+        split(&points[0], 0, points.size(), parts, longest_axis(points), slabs);
+        QtConcurrent::blockingMap(slabs, HullSlab(&points[0]));
+
+        std::vector<Point_3> vertices;
+        for(int s=0; s<slabs.size(); s++)
+            vertices.insert(vertices.end(), slabs[s].vertices.begin(), slabs[s].vertices.end());
+        CGAL::convex_hull_3(vertices.begin(), vertices.end(), poly);
+    }
+
+private:
+    /// Smaller slabs are not worth a task
+    enum{ MIN_PART = 50000 };
+
+    struct Slab{
+        Slab(){}
+        Slab(size_t begin, size_t end) : begin(begin), end(end){}
+        size_t begin, end;
+        std::vector<Point_3> vertices; ///< of the hull of the slab
+    };
+
+    struct HullSlab{
+        typedef void result_type;
+        HullSlab(const Point_3* points) : points(points){}
+        void operator()(Slab& slab) const {
+            const Point_3* begin = points + slab.begin;
+            const Point_3* end = points + slab.end;
+            /// Collinear points have no polyhedron, and are all kept
+            if(collinear(begin, end)){
+                slab.vertices.assign(begin, end);
+                return;
+            }
+            CGAL::Polyhedron_3<Kernel> hull;
+            CGAL::convex_hull_3(begin, end, hull);
+            slab.vertices.reserve(hull.size_of_vertices());
+            typename CGAL::Polyhedron_3<Kernel>::Vertex_iterator v;
+            for(v = hull.vertices_begin(); v!=hull.vertices_end(); v++)
+                slab.vertices.push_back(v->point());
+        }
+        const Point_3* points;
+    };
+
+    struct AxisLess{
+        AxisLess(int axis) : axis(axis){}
+        bool operator()(const Point_3& a, const Point_3& b) const { return a[axis] < b[axis]; }
+        int axis;
+    };
+
+    /// Splits [begin,end) in halves until there are "parts" slabs (in order)
+    static void split(Point_3* points, size_t begin, size_t end, int parts, int axis, QVector<Slab>& slabs){
+        if(parts==1){
+            slabs.push_back( Slab(begin, end) );
+            return;
+        }
+        int left = parts/2;
+        size_t middle = begin + (end-begin)*left/parts;
+        std::nth_element(points+begin, points+middle, points+end, AxisLess(axis));
+        split(points, begin, middle, left, axis, slabs);
+        split(points, middle, end, parts-left, axis, slabs);
+    }
+
+    static int longest_axis(const std::vector<Point_3>& points){
+        double min[3], max[3];
+        for(int k=0; k<3; k++) min[k] = max[k] = CGAL::to_double(points[0][k]);
+        for(size_t i=1; i<points.size(); i++){
+            for(int k=0; k<3; k++){
+                double c = CGAL::to_double(points[i][k]);
+                min[k] = std::min(min[k], c);
+                max[k] = std::max(max[k], c);
+            }
+        }
+        int axis = 0;
+        for(int k=1; k<3; k++)
+            if(max[k]-min[k] > max[axis]-min[axis]) axis = k;
+        return axis;
+    }
+
+    /// True if all the points are on a line (exact predicates)
+    static bool collinear(const Point_3* begin, const Point_3* end){
+        const Point_3* second = begin+1;
+        while(second<end && *second==*begin) second++;
+        if(second>=end) return true;
+        for(const Point_3* p=second+1; p<end; p++)
+            if(!CGAL::collinear(*begin, *second, *p)) return false;
+        return true;
+    }
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <boost/iterator/transform_iterator.hpp>
+#include <boost/property_map/property_map.hpp>
+#include "SurfaceMeshModel.h"
+
+/// CGAL views of the vertex coordinates of a Surface_mesh: nothing is copied,
+/// a Point_3 is made on the fly whenever an algorithm reads one. Two flavors:
+///  - a range of points, by vertex index, for algorithms that take iterators
+///    (e.g. CGAL::convex_hull_3(points.begin(), points.end(), poly))
+///  - a property map Vertex -> Point_3, for the ones that take a range of
+///    items and a point map (e.g. mesh.vertices() and points.point_map())
+/// @note the range covers the deleted vertices as well (hasGarbage())
+template <class Kernel>
+class SurfaceMeshPoints{
+public:
+    typedef typename Kernel::Point_3 Point_3;
+
+    /// Makes a point of a coordinate vector
+    struct To_point_3{
+        typedef Point_3 result_type;
+        Point_3 operator()(const Surface_mesh::Point& p) const { return Point_3(p.x(), p.y(), p.z()); }
+    };
+    /// Random access, dereferences to a Point_3 (by value)
+    typedef boost::transform_iterator<To_point_3, const Surface_mesh::Point*> Iterator;
+
+    /// Readable property map Vertex -> Point_3
+    struct Point_map{
+        typedef Surface_mesh::Vertex key_type;
+        typedef Point_3 value_type;
+        typedef Point_3 reference;
+        typedef boost::readable_property_map_tag category;
+        Point_map(){}
+        Point_map(const Surface_mesh::Vertex_property<Surface_mesh::Point>& points) : points(points){}
+        friend Point_3 get(const Point_map& map, Surface_mesh::Vertex v){ return To_point_3()(map.points[v]); }
+        Surface_mesh::Vertex_property<Surface_mesh::Point> points;
+    };
+
+    /// The mesh must outlive the view, and keep its vertices meanwhile
+    SurfaceMeshPoints(const Surface_mesh& mesh) : _mesh(mesh){
+        _points = mesh.get_vertex_property<Surface_mesh::Point>("v:point");
+    }
+
+    Iterator begin() const { return Iterator(data(), To_point_3()); }
+    Iterator end() const { return Iterator(data() + size(), To_point_3()); }
+    /// Vertices in the arrays, deleted ones included
+    size_t size() const { return _mesh.vertices_size(); }
+    /// True if some vertices in the range are deleted, see garbage_collection()
+    bool hasGarbage() const { return _mesh.has_garbage(); }
+
+    Point_map point_map() const { return Point_map(_points); }
+
+private:
+    const Surface_mesh::Point* data() const { return _points.data(); }
+    const Surface_mesh& _mesh;
+    Surface_mesh::Vertex_property<Surface_mesh::Point> _points;
+};
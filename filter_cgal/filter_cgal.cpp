@@ -6,43 +6,194 @@ Q_EXPORT_PLUGIN(filter_cgal)
 #include <CGAL/Tetrahedron_3.h> /// To compute convex hull volume
 #include <CGAL/Polyhedron_incremental_builder_3.h> /// To convert triangle into single face polyhedron
 #include <CGAL/Polyhedron_items_with_id_3.h>
+#include <QtConcurrentMap>
+#include <QFutureWatcher>
+#include <QAtomicInt>
+#include <QStringList>
+#include <QProgressDialog>
+#include <QApplication>
 
 typedef CGAL::Exact_predicates_inexact_constructions_kernel K; /// Chull requires exact predicate
 typedef K::Point_3 Point_3; /// Type of point for chull call
-typedef std::list<Point_3> Point_3_list; /// List of points
+typedef std::vector<Point_3> Point_3_vector; /// Points, contiguous
 typedef CGAL::Polyhedron_3<K,CGAL::Polyhedron_items_with_id_3> Polyhedron_3; 
 
 #include "Polyhedron3_to_SurfaceMesh.h"
+#include "ExtremePointCulling.h"
+#include "SurfaceMeshPoints.h"
+#include "ParallelConvexHull.h"
 
 /// Take a look here for better conversion to/from CGAL
 // #include "CGAL/Polyhedron_copy_3.h"
 
-void filter_cgal::applyFilter(RichParameterSet *){
-    
-    /// Dump data into CGAL-friendly format
-    Point_3_list points;
-    Vector3VertexProperty vpoint = mesh()->vertex_coordinates();
-    foreach(Vertex v, mesh()->vertices()){
-        Vector3& p = vpoint[v]; 
-        points.push_back( Point_3(p.x(), p.y(), p.z()) );
-    }
+/// Hull of the points of [begin,end) into poly, an error message if it failed.
+/// A raised "canceled" flag stops it between its steps, with an empty error.
+/// @note Iterator is random access, dereferences to a Point_3
+template <class Iterator>
+static QString convex_hull(Iterator begin, Iterator end, Polyhedron_3& poly, bool parallel, int threshold, const QAtomicInt* canceled=NULL){
     
     /// Pre-Check
-    if(points.size()<3)
-        throw StarlabException("Dataset is too small");
+    if(end-begin < 3)
+        return "Dataset is too small";
 
-    /// Compute hull
-    Polyhedron_3 poly;
-    CGAL::convex_hull_3(points.begin(), points.end(), poly);
+    /// Most points are inside, only the ones that may be on the hull go to
+    /// CGAL. They are read in place (survivors are copied)
+    Point_3_vector survivors;
+    ExtremePointCulling<K> culling;
+    culling(begin, end, survivors);
+    if(canceled && *canceled) return QString();
+
+    /// Compute hull, on every core for large inputs
+    if(parallel || int(survivors.size()) > threshold)
+        ParallelConvexHull<K>()(survivors, poly);
+    else
+        CGAL::convex_hull_3(survivors.begin(), survivors.end(), poly);
     
     /// Post-Check
     if(poly.size_of_vertices()<3)
-        throw StarlabException("Couldn't generate a solid convex hull");
+        return "Couldn't generate a solid convex hull";
+    return QString();
+}
+
+/// Hull of the vertices of mesh into poly, read in place
+static QString convex_hull(const Surface_mesh& mesh, Polyhedron_3& poly, bool parallel, int threshold){
+    SurfaceMeshPoints<K> points(mesh);
+    if(!points.hasGarbage())
+        return convex_hull(points.begin(), points.end(), poly, parallel, threshold);
+    
+    /// Deleted vertices are still in the arrays, gather the others
+    Point_3_vector live;
+    live.reserve(mesh.n_vertices());
+    SurfaceMeshPoints<K>::Point_map point = points.point_map();
+    foreach(Surface_mesh::Vertex v, mesh.vertices())
+        live.push_back( get(point, v) );
+    return convex_hull(live.begin(), live.end(), poly, parallel, threshold);
+}
+
+/// The hull of one model in a batch, computed in a worker thread from a copy
+/// of the points (the models may change meanwhile, e.g. while scanning)
+struct HullJob{
+    QString name;
+    std::vector<Surface_mesh::Point> points; ///< of the live vertices
+    bool parallel;
+    int threshold;
+    const QAtomicInt* canceled;
+    bool done;               ///< false if canceled before it finished
+    Polyhedron_3 poly;
+    QString error;
+};
+
+static void run_job(HullJob& job){
+    if(*job.canceled) return;
+    typedef SurfaceMeshPoints<K>::Iterator Iterator;
+    const Surface_mesh::Point* points = job.points.empty() ? NULL : &job.points[0];
+    Iterator begin(points, SurfaceMeshPoints<K>::To_point_3());
+    Iterator end(points + job.points.size(), SurfaceMeshPoints<K>::To_point_3());
+    
+    /// Nothing may escape a worker thread (CGAL failures, memory)
+    try{
+        job.error = convex_hull(begin, end, job.poly, job.parallel, job.threshold, job.canceled);
+    } catch(const std::exception& e){
+        job.error = e.what();
+    }
+    job.done = !*job.canceled;
+    std::vector<Surface_mesh::Point>().swap(job.points);
+}
+
+/// @{ models made by this filter are flagged, so that a batch does not hull
+/// them again. The name catches the hulls of earlier sessions (the flag is
+/// not saved)
+static void mark_hull(SurfaceMeshModel* model){ model->setProperty("convex_hull", true); }
+static bool is_hull(const Model* model){
+    return model->property("convex_hull").toBool() || model->name.endsWith("Convex Hull");
+}
+/// @}
+
+void filter_cgal::initParameters(RichParameterSet* pars){
+    pars->addParam( new RichBool("all_models", false, "All models", "Hull every mesh of the document, concurrently, instead of the selected one"));
+    pars->addParam( new RichBool("hull_hulls", false, "Include hulls", "With all models, also hull the convex hulls made earlier"));
+    pars->addParam( new RichBool("parallel", false, "Parallel hull", "Hull parts of the points on every core, then the hull of their hulls"));
+    pars->addParam( new RichInt("parallel_threshold", 500000, "Parallel above", "Points left after culling above which the parallel hull is used anyway"));
+}
+
+void filter_cgal::applyFilter(RichParameterSet* pars){
+    bool parallel = pars->getBool("parallel");
+    int threshold = pars->getInt("parallel_threshold");
+    if(pars->getBool("all_models")){
+        apply_batch(parallel, threshold, pars->getBool("hull_hulls"));
+        return;
+    }
+
+    Polyhedron_3 poly;
+    QString error = convex_hull(*mesh(), poly, parallel, threshold);
+    if(!error.isEmpty())
+        throw StarlabException(error);
     
     /// Convert back
     SurfaceMeshModel* chull = new SurfaceMeshModel("","Convex Hull");
+    mark_hull(chull);
     document()->addModel(chull);
     Polyhedron3_to_SurfaceMesh(poly, *chull);
     document()->setSelectedModel(chull);
 }
 
+void filter_cgal::apply_batch(bool parallel, int threshold, bool hulls){
+    /// The points are copied before any job starts: timers of other plugins
+    /// keep running (and may edit the models) while the dialog is up
+    QAtomicInt canceled(0);
+    std::vector<HullJob> jobs;
+    jobs.reserve(document()->models().size());
+    foreach(Model* model, document()->models()){
+        SurfaceMeshModel* mesh = qobject_cast<SurfaceMeshModel*>(model);
+        if(!mesh || (!hulls && is_hull(mesh))) continue;
+        jobs.push_back(HullJob());
+        HullJob& job = jobs.back();
+        job.name = mesh->name;
+        job.points.reserve(mesh->n_vertices());
+        Surface_mesh::Vertex_property<Surface_mesh::Point> points = mesh->get_vertex_property<Surface_mesh::Point>("v:point");
+        foreach(Surface_mesh::Vertex v, mesh->vertices())
+            job.points.push_back(points[v]);
+        job.parallel = parallel;
+        job.threshold = threshold;
+        job.canceled = &canceled;
+        job.done = false;
+    }
+    if(jobs.empty())
+        throw StarlabException(hulls ? "No mesh in the document" : "No mesh in the document other than convex hulls");
+
+    /// One job per model on the global pool, the slowest one sets the pace.
+    /// Canceling skips the jobs that did not start yet, and stops the running
+    /// ones after their current step (the hull itself can't be interrupted)
+    QProgressDialog dialog("Computing the convex hulls...", "Cancel", 0, jobs.size(), QApplication::activeWindow());
+    dialog.setWindowModality(Qt::WindowModal);
+    QFutureWatcher<void> watcher;
+    connect(&watcher, SIGNAL(finished()), &dialog, SLOT(reset()));
+    connect(&dialog, SIGNAL(canceled()), &watcher, SLOT(cancel()));
+    connect(&watcher, SIGNAL(progressRangeChanged(int,int)), &dialog, SLOT(setRange(int,int)));
+    connect(&watcher, SIGNAL(progressValueChanged(int)), &dialog, SLOT(setValue(int)));
+    watcher.setFuture(QtConcurrent::map(jobs, run_job));
+    dialog.exec();
+    if(dialog.wasCanceled())
+        canceled = 1;
+    watcher.waitForFinished();
+
+    /// Models are made here, in the GUI thread, and added in one update
+    QStringList failures;
+    document()->pushBusy();
+    for(size_t i=0; i<jobs.size(); i++){
+        if(!jobs[i].done) continue;
+        if(!jobs[i].error.isEmpty()){
+            failures << jobs[i].name + ": " + jobs[i].error;
+            continue;
+        }
+        SurfaceMeshModel* chull = new SurfaceMeshModel("", jobs[i].name + " Convex Hull");
+        mark_hull(chull);
+        Polyhedron3_to_SurfaceMesh(jobs[i].poly, *chull);
+        document()->addModel(chull);
+    }
+    document()->popBusy();
+    
+    /// The hulls that worked are in the document already
+    if(!failures.isEmpty())
+        throw StarlabException(QString("%1 of %2 convex hulls failed\n").arg(failures.size()).arg(jobs.size()) + failures.join("\n"));
+}
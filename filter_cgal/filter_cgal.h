@@ -7,5 +7,10 @@ class filter_cgal : public SurfaceMeshFilterPlugin{
 
 public:
     QString name() { return "Convex Hull (CGAL)"; }
+    void initParameters(RichParameterSet*);
     void applyFilter(RichParameterSet*);
+private:
+    /// Hulls every mesh of the document concurrently, see HullJob. The hulls
+    /// made by this filter are skipped unless "hulls" is set
+    void apply_batch(bool parallel, int threshold, bool hulls);
 };
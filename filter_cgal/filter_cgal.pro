@@ -6,3 +6,6 @@ StarlabTemplate(plugin)
 HEADERS += filter_cgal.h
 SOURCES += filter_cgal.cpp
 HEADERS += Polyhedron3_to_SurfaceMesh.h
+HEADERS += ExtremePointCulling.h
+HEADERS += SurfaceMeshPoints.h
+HEADERS += ParallelConvexHull.h
@@ -0,0 +1,111 @@
+#include "CloudRenderer.h"
+#include <QtOpenGL>
+
+CloudRenderer::CloudRenderer() : _buffer(QGLBuffer::VertexBuffer){
+    _count = 0;
+    _uploaded_index = -1;
+    _uploaded_stride = 1;
+    _normals_offset = -1;
+}
+
+/// Copies the valid points of the frame one after the other (and their
+/// normals, if "normals" is given), returns how many
+static int compact(const PointFrame& frame, int stride, float* out, float* normals){
+    const float* xyz = frame.xyz();
+    const float* in_normals = frame.normals();
+    const unsigned char* valid = frame.valid();
+    int n = 0;
+    for(int y=0; y<frame.height(); y+=stride){
+        for(int i=y*frame.width(), end=i+frame.width(); i<end; i+=stride){
+            if(!valid[i]) continue;
+            out[3*n+0] = xyz[3*i+0];
+            out[3*n+1] = xyz[3*i+1];
+            out[3*n+2] = xyz[3*i+2];
+            if(normals){
+                normals[3*n+0] = in_normals[3*i+0];
+                normals[3*n+1] = in_normals[3*i+1];
+                normals[3*n+2] = in_normals[3*i+2];
+            }
+            n++;
+        }
+    }
+    return n;
+}
+
+void CloudRenderer::upload(const PointFrame& frame, int stride){
+    /// Points, then normals at a fixed offset (as many as there are pixels)
+    bool normals = frame.hasNormals();
+    int floats = 3 * frame.size();
+    int bytes = (normals ? 2 : 1) * floats * sizeof(float);
+
+    /// Allocating with no data orphans the previous storage, so the driver
+    /// doesn't have to wait for the GPU to finish drawing the previous frame
+    _buffer.bind();
+    _buffer.allocate(bytes);
+    float* mapped = (float*) _buffer.map(QGLBuffer::WriteOnly);
+    if(mapped){
+        _count = compact(frame, stride, mapped, normals ? mapped+floats : NULL);
+        _buffer.unmap();
+    } else {
+        _staging.resize((normals ? 2 : 1) * floats);
+        _count = compact(frame, stride, &_staging[0], normals ? &_staging[floats] : NULL);
+        _buffer.write(0, &_staging[0], 3 * _count * sizeof(float));
+        if(normals)
+            _buffer.write(floats * sizeof(float), &_staging[floats], 3 * _count * sizeof(float));
+    }
+    _buffer.release();
+    _uploaded_index = frame.index();
+    _uploaded_stride = stride;
+    _normals_offset = normals ? floats * sizeof(float) : -1;
+}
+
+void CloudRenderer::draw(const PointFrame& frame, int stride){
+    if(frame.empty()) return;
+    if(!_buffer.isCreated()){
+        _buffer.create();
+        _buffer.setUsagePattern(QGLBuffer::StreamDraw);
+    }
+
+    /// Repaints of the same frame reuse what is on the GPU already
+    if(frame.index() != _uploaded_index || stride != _uploaded_stride)
+        upload(frame, qMax(1, stride));
+
+    _buffer.bind();
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, 0);
+    if(_normals_offset>=0){
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, 0, (const GLvoid*)(size_t) _normals_offset);
+    }
+    glDrawArrays(GL_POINTS, 0, _count);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    _buffer.release();
+}
+
+int CloudRenderer::levelOfDetail(const PointFrame& frame, int maxStride){
+    if(frame.empty() || !frame.hasBounds()) return 1;
+    Eigen::Vector3f center = (frame.boundsMin() + frame.boundsMax()) / 2;
+    /// Distance between neighboring pixels at the center
+    float spacing = center.z() * frame.xzFactor() / frame.width();
+
+    GLfloat modelview[16], projection[16];
+    GLint viewport[4];
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    Eigen::Map<Eigen::Matrix4f> mv(modelview);
+    Eigen::Map<Eigen::Matrix4f> p(projection);
+
+    /// Screen pixels per world unit at the center (perspective or orthographic)
+    Eigen::Vector4f eye = mv * Eigen::Vector4f(center.x(), center.y(), center.z(), 1);
+    float w = p(3,2)*eye.z() + p(3,3);
+    if(w <= 0) return 1;
+    float scale = mv.block<3,1>(0,0).norm();
+    float pixels = spacing * scale * p(0,0) * viewport[2] / 2 / w;
+
+    int stride = 1;
+    while(2*stride <= maxStride && 2*stride*pixels <= 1.0f)
+        stride *= 2;
+    return stride;
+}
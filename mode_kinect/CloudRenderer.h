@@ -0,0 +1,34 @@
+#pragma once
+#include <QGLBuffer>
+#include "PointFrame.h"
+
+/// Draws a PointFrame from a vertex buffer object. The buffer is refilled
+/// (orphaned, then mapped) only when a frame with a new index is drawn, so
+/// repaints between two sensor frames cost a single glDrawArrays. Pixels
+/// without depth are compacted away while uploading, normals are uploaded
+/// along if the frame has them. A stride draws only
+/// every stride-th pixel of every stride-th row, see levelOfDetail().
+/// @note must be used from the thread owning the GL context
+class CloudRenderer{
+public:
+    CloudRenderer();
+    /// Uploads the frame if it was not uploaded already, then draws it
+    void draw(const PointFrame& frame, int stride=1);
+    /// Number of points currently in the buffer
+    int count() const { return _count; }
+
+    /// Largest power of two stride (up to maxStride) that keeps neighboring 
+    /// points of the frame at most one screen pixel apart around the center 
+    /// of its bounds, with the current OpenGL matrices and viewport. Zoomed 
+    /// out views thus draw a fraction of the points without visible holes.
+    static int levelOfDetail(const PointFrame& frame, int maxStride=8);
+
+private:
+    void upload(const PointFrame& frame, int stride);
+    QGLBuffer _buffer;
+    int _count;          ///< valid points in the buffer
+    int _uploaded_index; ///< index of the frame in the buffer
+    int _uploaded_stride; ///< stride of the frame in the buffer
+    int _normals_offset;  ///< of the normals in the buffer (bytes), -1 without normals
+    std::vector<float> _staging; ///< used when the driver can't map buffers
+};
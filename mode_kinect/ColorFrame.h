@@ -0,0 +1,59 @@
+#pragma once
+#include <QImage>
+#include <QSharedPointer>
+#include "OpenNI.h"
+#include "RawFrameFile.h"
+
+/// A color frame that keeps the OpenNI buffer alive instead of copying it.
+/// view() wraps the RGB888 pixels in a read-only QImage (no copy), image()
+/// makes the deep copy for consumers that want to modify the pixels.
+class ColorFrame{
+public:
+    ColorFrame() : _data(NULL), _width(0), _height(0), _stride(0), _index(-1){}
+    explicit ColorFrame(const openni::VideoFrameRef& frame) : _frame(frame){
+        _data = (const uchar*) frame.getData();
+        _width = frame.getWidth();
+        _height = frame.getHeight();
+        _stride = frame.getStrideInBytes();
+        _index = frame.getFrameIndex();
+    }
+    /// Over pixels owned by someone else, they must outlive the frame
+    ColorFrame(const uchar* data, int width, int height, int index) :
+        _data(data), _width(width), _height(height), _stride(3*width), _index(index){}
+    /// Over frame i of a memory mapped recording, which stays mapped as long
+    /// as a copy of this frame (e.g. one queued in a FramePipeline) is alive
+    ColorFrame(const QSharedPointer<RawFrameReader>& source, int i) : _source(source){
+        _data = source->color(i);
+        _width = source->header().colorWidth;
+        _height = source->header().colorHeight;
+        _stride = 3*_width;
+        _index = source->index(i);
+    }
+
+    bool empty() const { return _data==NULL; }
+    int width() const { return _width; }
+    int height() const { return _height; }
+    /// Index of the sensor frame, -1 if empty
+    int index() const { return _index; }
+    /// Row-major RGB888 pixels
+    const uchar* data() const { return _data; }
+    int bytesPerLine() const { return _stride; }
+
+    /// Non-owning image over data(), valid as long as this frame is.
+    /// Writing to it detaches (i.e. copies) it, leaving the frame untouched
+    QImage view() const {
+        if(empty()) return QImage();
+        return QImage(data(), width(), height(), bytesPerLine(), QImage::Format_RGB888);
+    }
+    /// Mutable deep copy of the pixels
+    QImage image() const { return view().copy(); }
+
+private:
+    openni::VideoFrameRef _frame; ///< keeps OpenNI's buffer alive
+    QSharedPointer<RawFrameReader> _source; ///< keeps the recording mapped
+    const uchar* _data;
+    int _width;
+    int _height;
+    int _stride;
+    int _index;
+};
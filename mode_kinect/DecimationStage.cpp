@@ -0,0 +1,98 @@
+#include "DecimationStage.h"
+#include <algorithm>
+#include <climits>
+
+DecimationStage::DecimationStage(int leaf, int levels, float tolerance){
+    _leaf = qMax(2, leaf);
+    _levels = qMax(1, levels);
+    _tolerance = tolerance;
+}
+
+void DecimationStage::decimate(const PointFrame& fine, PointFrame& coarse, int leaf, float tolerance, int begin, int end){
+    const float* xyz = fine.xyz();
+    const unsigned char* valid = fine.valid();
+    bool unprojected = fine.unprojected();
+    int width = fine.width();
+
+    for(int cy=begin; cy<end; cy++){
+        for(int cx=0; cx<coarse.width(); cx++){
+            int x0 = cx*leaf, y0 = cy*leaf;
+            int x1 = qMin(x0+leaf, width), y1 = qMin(y0+leaf, fine.height());
+
+            /// Closest measurement of the block
+            unsigned short closest = USHRT_MAX;
+            for(int y=y0; y<y1; y++)
+                for(int x=x0; x<x1; x++){
+                    unsigned short d = fine.depthAt(y*width+x);
+                    if(d) closest = std::min(closest, d);
+                }
+
+            int c = cy*coarse.width() + cx;
+            if(closest==USHRT_MAX){
+                if(coarse.hasDepth()) coarse.depth()[c] = 0;
+                if(unprojected){
+                    coarse.valid()[c] = 0;
+                    std::fill(coarse.xyz()+3*c, coarse.xyz()+3*c+3, 0.0f);
+                }
+                continue;
+            }
+
+            /// Average of the foreground
+            float limit = closest * (1+tolerance);
+            float sum[4] = {0,0,0,0};
+            int n = 0;
+            for(int y=y0; y<y1; y++)
+                for(int x=x0; x<x1; x++){
+                    int i = y*width+x;
+                    unsigned short d = fine.depthAt(i);
+                    if(!d || d>limit) continue;
+                    sum[3] += d;
+                    if(unprojected && valid[i]){
+                        sum[0] += xyz[3*i+0];
+                        sum[1] += xyz[3*i+1];
+                        sum[2] += xyz[3*i+2];
+                    }
+                    n++;
+                }
+            if(coarse.hasDepth()) coarse.depth()[c] = (unsigned short)(sum[3]/n + .5f);
+            if(unprojected){
+                coarse.valid()[c] = 1;
+                for(int k=0; k<3; k++)
+                    coarse.xyz()[3*c+k] = sum[k]/n;
+            }
+        }
+    }
+}
+
+/// Tile of a level
+struct DecimateRows{
+    DecimateRows(const PointFrame& fine, PointFrame& coarse, int leaf, float tolerance) 
+        : fine(fine), coarse(coarse), leaf(leaf), tolerance(tolerance){}
+    void operator()(int begin, int end) const{
+        DecimationStage::decimate(fine, coarse, leaf, tolerance, begin, end);
+    }
+    const PointFrame& fine;
+    PointFrame& coarse;
+    int leaf;
+    float tolerance;
+};
+
+void DecimationStage::process(FrameJob& job){
+    job.levels.resize(_levels);
+    for(int l=0; l<_levels; l++){
+        /// Every level is built from the previous one
+        const PointFrame& fine = job.points(l);
+        PointFrame& coarse = job.levels[l];
+        int width = (fine.width()+_leaf-1)/_leaf;
+        int height = (fine.height()+_leaf-1)/_leaf;
+        if(coarse.width()!=width || coarse.height()!=height)
+            coarse.resize(width, height);
+        coarse.setIndex(fine.index());
+        coarse.setSensor(fine.sensor());
+        coarse.setUnprojected(fine.unprojected());
+        coarse.setHasDepth(fine.hasDepth());
+        coarse.setIntrinsics(fine.xzFactor(), fine.yzFactor());
+        std::copy(fine.bounds(), fine.bounds()+6, coarse.bounds());
+        forEachRowTile(height, DecimateRows(fine, coarse, _leaf, _tolerance), qMax(1, 32/_leaf));
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "FrameStage.h"
+
+/// Builds the levels of detail of FrameJob: every level averages blocks of
+/// leaf x leaf pixels of the previous one, so that level l has leaf^l times
+/// fewer points per row and per column and stays an organized frame. Only the
+/// points closest to the camera in a block are averaged (within "tolerance",
+/// relative to their depth), a block on a silhouette thus does not produce a
+/// point floating between the foreground and the background.
+/// Register it first, following stages pick their resolution with 
+/// FrameJob::points(level) and get proportionally cheaper.
+class DecimationStage : public FrameStage{
+public:
+    DecimationStage(int leaf=2, int levels=3, float tolerance=0.05f);
+    QString name() const { return "Decimation"; }
+    void process(FrameJob& job);
+
+    /// Averages the blocks of rows [begin,end) of "coarse", coarse must be sized already
+    static void decimate(const PointFrame& fine, PointFrame& coarse, int leaf, float tolerance, int begin, int end);
+
+private:
+    int _leaf;
+    int _levels;
+    float _tolerance;
+};
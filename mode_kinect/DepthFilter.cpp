@@ -0,0 +1,90 @@
+#include "DepthFilter.h"
+#include "FrameStage.h"
+#include <algorithm>
+
+void DepthFilter::setParameters(const Parameters& parameters){
+    QMutexLocker locker(&_mutex);
+    _parameters = parameters;
+}
+
+DepthFilter::Parameters DepthFilter::parameters() const{
+    QMutexLocker locker(&_mutex);
+    return _parameters;
+}
+
+bool DepthFilter::enabled() const{
+    QMutexLocker locker(&_mutex);
+    return _parameters.temporal || (_parameters.spatial && _parameters.radius>0);
+}
+
+/// @{ tiles of rows
+struct TemporalRows{
+    void operator()(int begin, int end) const{
+        int offset = begin*width, count = (end-begin)*width;
+        kernels.temporal(depth+offset, average+offset, depth+offset, count, weight, motion);
+    }
+    const DepthKernels& kernels;
+    unsigned short* depth;
+    unsigned short* average;
+    int width, weight, motion;
+};
+
+/// Along the rows, the pixels closer than radius to the sides are copied
+struct HorizontalRows{
+    void operator()(int begin, int end) const{
+        for(int y=begin; y<end; y++){
+            const unsigned short* row = in + y*width;
+            unsigned short* out_row = out + y*width;
+            std::copy(row, row+radius, out_row);
+            std::copy(row+width-radius, row+width, out_row+width-radius);
+            kernels.smooth(row+radius, out_row+radius, width-2*radius, 1, radius, tolerance);
+        }
+    }
+    const DepthKernels& kernels;
+    const unsigned short* in;
+    unsigned short* out;
+    int width, height, radius, tolerance;
+};
+
+/// Along the columns, the rows closer than radius to the top and bottom are copied
+struct VerticalRows{
+    void operator()(int begin, int end) const{
+        for(int y=begin; y<end; y++){
+            const unsigned short* row = in + y*width;
+            if(y<radius || y>=height-radius)
+                std::copy(row, row+width, out + y*width);
+            else
+                kernels.smooth(row, out + y*width, width, width, radius, tolerance);
+        }
+    }
+    const DepthKernels& kernels;
+    const unsigned short* in;
+    unsigned short* out;
+    int width, height, radius, tolerance;
+};
+/// @}
+
+void DepthFilter::apply(unsigned short* depth, int width, int height){
+    Parameters p = parameters();
+    int count = width*height;
+
+    if(!p.temporal){
+        _average.clear(); ///< start over when it is turned back on
+    } else {
+        if((int)_average.size()!=count) 
+            _average.assign(count, 0);
+        TemporalRows rows = { kernels, depth, &_average[0], width,
+                              qBound(1, int(p.weight*256), 256), qBound(0, int(p.motion*1024), 1023) };
+        FrameStage::forEachRowTile(height, rows);
+    }
+
+    int radius = qMin(p.radius, qMin(width, height)/2 - 1);
+    if(p.spatial && radius>0){
+        _scratch.resize(count);
+        int tolerance = qBound(0, int(p.tolerance*1024), 1023);
+        HorizontalRows horizontal = { kernels, depth, &_scratch[0], width, height, radius, tolerance };
+        FrameStage::forEachRowTile(height, horizontal);
+        VerticalRows vertical = { kernels, &_scratch[0], depth, width, height, radius, tolerance };
+        FrameStage::forEachRowTile(height, vertical);
+    }
+}
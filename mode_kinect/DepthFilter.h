@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <QMutex>
+#include "DepthKernels.h"
+
+/// Denoises raw depth images before they are unprojected: an exponential
+/// average over time (restarted where the scene moves) followed by a
+/// separable, edge preserving smoothing that also fills the holes of the
+/// sensor. Both run the SIMD kernels of DepthKernels on tiles of rows in
+/// parallel, a VGA frame takes about a millisecond.
+/// @note apply() from one thread, parameters may be changed from any thread
+class DepthFilter{
+public:
+    struct Parameters{
+        Parameters() : temporal(false), weight(0.25f), motion(0.03f), 
+                       spatial(false), radius(2), tolerance(0.03f){}
+        bool temporal;   ///< average over time
+        float weight;    ///< of a new frame in the average, (0,1]
+        float motion;    ///< depth change (relative) that restarts the average
+        bool spatial;    ///< smooth and fill holes
+        int radius;      ///< of the smoothing window, in pixels
+        float tolerance; ///< depth difference (relative) smoothed across
+    };
+
+    void setParameters(const Parameters& parameters);
+    Parameters parameters() const;
+    /// Is any of the filters on?
+    bool enabled() const;
+
+    /// Filters the image in place
+    void apply(unsigned short* depth, int width, int height);
+
+private:
+    DepthKernels kernels;
+    mutable QMutex _mutex; ///< guards _parameters
+    Parameters _parameters;
+    std::vector<unsigned short> _average; ///< state of the temporal filter
+    std::vector<unsigned short> _scratch; ///< between the two smoothing passes
+};
@@ -0,0 +1,62 @@
+#include "DepthFilterWidget.h"
+#include <QCheckBox>
+#include <QDoubleSpinBox>
+#include <QSpinBox>
+#include <QFormLayout>
+
+/// Spin box of a percentage stored as a fraction
+static QDoubleSpinBox* percent(double value, double min, double max, QWidget* parent){
+    QDoubleSpinBox* box = new QDoubleSpinBox(parent);
+    box->setRange(min, max);
+    box->setDecimals(1);
+    box->setSuffix(" %");
+    box->setValue(value*100);
+    return box;
+}
+
+DepthFilterWidget::DepthFilterWidget(DepthFilter* filter, QWidget* parent) : 
+    QGroupBox("Depth denoising", parent), filter(filter){
+    DepthFilter::Parameters p = filter->parameters();
+
+    temporal = new QCheckBox("Temporal", this);
+    temporal->setChecked(p.temporal);
+    weight = percent(p.weight, 1, 100, this);
+    weight->setToolTip("Weight of a new frame in the average");
+    motion = percent(p.motion, 0, 99.9, this);
+    motion->setToolTip("Depth change that restarts the average");
+
+    spatial = new QCheckBox("Smooth / fill holes", this);
+    spatial->setChecked(p.spatial);
+    radius = new QSpinBox(this);
+    radius->setRange(1, 8);
+    radius->setSuffix(" px");
+    radius->setValue(p.radius);
+    tolerance = percent(p.tolerance, 0, 99.9, this);
+    tolerance->setToolTip("Depth difference that is not smoothed across (edges)");
+
+    QFormLayout* layout = new QFormLayout(this);
+    layout->addRow(temporal);
+    layout->addRow("New frame", weight);
+    layout->addRow("Motion", motion);
+    layout->addRow(spatial);
+    layout->addRow("Radius", radius);
+    layout->addRow("Edges", tolerance);
+
+    connect(temporal, SIGNAL(toggled(bool)), this, SLOT(apply()));
+    connect(spatial, SIGNAL(toggled(bool)), this, SLOT(apply()));
+    connect(weight, SIGNAL(valueChanged(double)), this, SLOT(apply()));
+    connect(motion, SIGNAL(valueChanged(double)), this, SLOT(apply()));
+    connect(tolerance, SIGNAL(valueChanged(double)), this, SLOT(apply()));
+    connect(radius, SIGNAL(valueChanged(int)), this, SLOT(apply()));
+}
+
+void DepthFilterWidget::apply(){
+    DepthFilter::Parameters p;
+    p.temporal = temporal->isChecked();
+    p.weight = weight->value()/100;
+    p.motion = motion->value()/100;
+    p.spatial = spatial->isChecked();
+    p.radius = radius->value();
+    p.tolerance = tolerance->value()/100;
+    filter->setParameters(p);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <QGroupBox>
+#include "DepthFilter.h"
+class QCheckBox;
+class QDoubleSpinBox;
+class QSpinBox;
+
+/// Controls of a DepthFilter, for the Kinect dock widget. Changes apply to
+/// the next frame.
+class DepthFilterWidget : public QGroupBox{
+    Q_OBJECT
+public:
+    DepthFilterWidget(DepthFilter* filter, QWidget* parent=0);
+private slots:
+    /// Hands the state of the controls to the filter
+    void apply();
+private:
+    DepthFilter* filter;
+    QCheckBox* temporal;
+    QDoubleSpinBox* weight;
+    QDoubleSpinBox* motion;
+    QCheckBox* spatial;
+    QSpinBox* radius;
+    QDoubleSpinBox* tolerance;
+};
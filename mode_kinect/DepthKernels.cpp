@@ -0,0 +1,328 @@
+#include "DepthKernels.h"
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+
+/// Intrinsics are compiled per-function, so the plugin itself does not need
+/// to be built with -mavx2 (which would crash on older CPUs)
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define KINECT_X86
+    #define TARGET_SSE41 __attribute__((target("sse4.1")))
+    #define TARGET_AVX2  __attribute__((target("avx2")))
+    #include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #define KINECT_X86
+    #define TARGET_SSE41
+    #define TARGET_AVX2
+    #include <intrin.h>
+    #include <immintrin.h>
+#endif
+
+/// @{ scalar
+/// Extends bounds with the valid points (the SIMD flavours finish with it)
+static void unproject_tail(const unsigned short* depth, const float* raysX, const float* raysY, float* xyz, unsigned char* valid, float* bounds, int count){
+    for(int i=0; i<count; i++){
+        float d = depth[i];
+        float p[3] = { raysX[i]*d, raysY[i]*d, d };
+        xyz[3*i+0] = p[0];
+        xyz[3*i+1] = p[1];
+        xyz[3*i+2] = p[2];
+        valid[i] = (depth[i]!=0);
+        if(!valid[i]) continue;
+        for(int c=0; c<3; c++){
+            bounds[c]   = std::min(bounds[c], p[c]);
+            bounds[3+c] = std::max(bounds[3+c], p[c]);
+        }
+    }
+}
+
+static void reset_bounds(float* bounds){
+    for(int c=0; c<3; c++){
+        bounds[c]   =  FLT_MAX;
+        bounds[3+c] = -FLT_MAX;
+    }
+}
+
+/// Folds the per-lane minima/maxima of the SIMD flavours, lo/hi are 3 planes of "lanes" floats
+static void merge_lanes(const float* lo, const float* hi, int lanes, float* bounds){
+    for(int c=0; c<3; c++){
+        for(int l=0; l<lanes; l++){
+            bounds[c]   = std::min(bounds[c], lo[c*lanes+l]);
+            bounds[3+c] = std::max(bounds[3+c], hi[c*lanes+l]);
+        }
+    }
+}
+
+static void unproject_scalar(const unsigned short* depth, const float* raysX, const float* raysY, float* xyz, unsigned char* valid, float* bounds, int count){
+    reset_bounds(bounds);
+    unproject_tail(depth, raysX, raysY, xyz, valid, bounds, count);
+}
+
+static void temporal_scalar(const unsigned short* depth, unsigned short* average, unsigned short* out, int count, int weight, int motion){
+    for(int i=0; i<count; i++){
+        int d = depth[i];
+        int a = average[i];
+        if(!d){
+            out[i] = a;
+            average[i] = 0;
+            continue;
+        }
+        int diff = d - a;
+        if(!a || std::abs(diff)*1024 > d*motion)
+            a = d;
+        else
+            a += (diff*weight + 128) >> 8;
+        average[i] = out[i] = a;
+    }
+}
+
+static void smooth_scalar(const unsigned short* in, unsigned short* out, int count, int step, int radius, int tolerance){
+    for(int i=0; i<count; i++){
+        int c = in[i];
+        int tol = (unsigned(c)*unsigned(tolerance*64)) >> 16; ///< same rounding as the SIMD flavour
+        int sum = 0, n = 0, farthest = 0;
+        for(int k=-radius; k<=radius; k++){
+            int d = in[i+k*step];
+            farthest = std::max(farthest, d);
+            if(!d || std::abs(d-c) > tol) continue;
+            sum += d;
+            n++;
+        }
+        out[i] = c ? (unsigned short)lrintf(float(sum)/n) : farthest;
+    }
+}
+/// @}
+
+#ifdef KINECT_X86
+/// @{ SSE4.1, 8 pixels per iteration
+/// Stores four points given as planes (x0..x3),(y0..y3),(z0..z3) as x0y0z0x1 y1z1x2y2 z2x3y3z3
+TARGET_SSE41 static inline void store_xyz4(float* out, __m128 x, __m128 y, __m128 z){
+    __m128 xy_lo = _mm_unpacklo_ps(x, y);                          ///< x0 y0 x1 y1
+    __m128 xy_hi = _mm_unpackhi_ps(x, y);                          ///< x2 y2 x3 y3
+    __m128 z0x1  = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1,1,0,0));     ///< z0 z0 x1 x1
+    __m128 y1z1  = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1,1,1,1));     ///< y1 y1 z1 z1
+    __m128 z2x3  = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3,3,2,2));     ///< z2 z2 x3 x3
+    __m128 y3z3  = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3,3,3,3));     ///< y3 y3 z3 z3
+    _mm_storeu_ps(out+0, _mm_shuffle_ps(xy_lo, z0x1, _MM_SHUFFLE(2,0,1,0)));
+    _mm_storeu_ps(out+4, _mm_shuffle_ps(y1z1, xy_hi, _MM_SHUFFLE(1,0,2,0)));
+    _mm_storeu_ps(out+8, _mm_shuffle_ps(z2x3, y3z3, _MM_SHUFFLE(2,0,2,0)));
+}
+
+/// Pixels without depth (all bits set in empty) must not extend the box
+TARGET_SSE41 static inline void extend4(__m128& lo, __m128& hi, __m128 v, __m128 empty){
+    lo = _mm_min_ps(lo, _mm_blendv_ps(v, _mm_set1_ps(FLT_MAX), empty));
+    hi = _mm_max_ps(hi, _mm_blendv_ps(v, _mm_set1_ps(-FLT_MAX), empty));
+}
+
+TARGET_SSE41 static void unproject_sse41(const unsigned short* depth, const float* raysX, const float* raysY, float* xyz, unsigned char* valid, float* bounds, int count){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one  = _mm_set1_epi8(1);
+    __m128 lo[3], hi[3];
+    for(int c=0; c<3; c++){
+        lo[c] = _mm_set1_ps(FLT_MAX);
+        hi[c] = _mm_set1_ps(-FLT_MAX);
+    }
+    int i = 0;
+    for(; i+8<=count; i+=8){
+        __m128i d16 = _mm_loadu_si128((const __m128i*)(depth+i));
+        /// 0xFF where depth is zero, +1 wraps it to 0 and turns 0x00 into 1
+        __m128i empty = _mm_cmpeq_epi16(d16, zero);
+        _mm_storel_epi64((__m128i*)(valid+i), _mm_add_epi8(_mm_packs_epi16(empty, empty), one));
+        __m128 e0 = _mm_castsi128_ps(_mm_cvtepi16_epi32(empty));
+        __m128 e1 = _mm_castsi128_ps(_mm_cvtepi16_epi32(_mm_srli_si128(empty,8)));
+        __m128 d0 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(d16));
+        __m128 d1 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(d16,8)));
+        __m128 x0 = _mm_mul_ps(_mm_loadu_ps(raysX+i),   d0), y0 = _mm_mul_ps(_mm_loadu_ps(raysY+i),   d0);
+        __m128 x1 = _mm_mul_ps(_mm_loadu_ps(raysX+i+4), d1), y1 = _mm_mul_ps(_mm_loadu_ps(raysY+i+4), d1);
+        store_xyz4(xyz+3*i,    x0, y0, d0);
+        store_xyz4(xyz+3*i+12, x1, y1, d1);
+        extend4(lo[0], hi[0], x0, e0); extend4(lo[0], hi[0], x1, e1);
+        extend4(lo[1], hi[1], y0, e0); extend4(lo[1], hi[1], y1, e1);
+        extend4(lo[2], hi[2], d0, e0); extend4(lo[2], hi[2], d1, e1);
+    }
+    float lanes_lo[12], lanes_hi[12];
+    for(int c=0; c<3; c++){
+        _mm_storeu_ps(lanes_lo+4*c, lo[c]);
+        _mm_storeu_ps(lanes_hi+4*c, hi[c]);
+    }
+    reset_bounds(bounds);
+    merge_lanes(lanes_lo, lanes_hi, 4, bounds);
+    unproject_tail(depth+i, raysX+i, raysY+i, xyz+3*i, valid+i, bounds, count-i);
+}
+
+TARGET_SSE41 static void temporal_sse41(const unsigned short* depth, unsigned short* average, unsigned short* out, int count, int weight, int motion){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w = _mm_set1_epi32(weight);
+    const __m128i m = _mm_set1_epi32(motion);
+    const __m128i half = _mm_set1_epi32(128);
+    int i = 0;
+    for(; i+8<=count; i+=8){
+        __m128i d16 = _mm_loadu_si128((const __m128i*)(depth+i));
+        __m128i a16 = _mm_loadu_si128((const __m128i*)(average+i));
+        __m128i filtered[2];
+        for(int h=0; h<2; h++){
+            __m128i d = _mm_cvtepu16_epi32(h ? _mm_srli_si128(d16,8) : d16);
+            __m128i a = _mm_cvtepu16_epi32(h ? _mm_srli_si128(a16,8) : a16);
+            __m128i diff = _mm_sub_epi32(d, a);
+            __m128i f = _mm_add_epi32(a, _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(diff, w), half), 8));
+            /// Restart where nothing was averaged yet or where the scene moved
+            __m128i moved = _mm_cmpgt_epi32(_mm_slli_epi32(_mm_abs_epi32(diff), 10), _mm_mullo_epi32(d, m));
+            __m128i restart = _mm_or_si128(moved, _mm_cmpeq_epi32(a, zero));
+            filtered[h] = _mm_blendv_epi8(f, d, restart);
+        }
+        __m128i f16 = _mm_packus_epi32(filtered[0], filtered[1]);
+        __m128i hole = _mm_cmpeq_epi16(d16, zero);
+        _mm_storeu_si128((__m128i*)(out+i), _mm_blendv_epi8(f16, a16, hole));
+        _mm_storeu_si128((__m128i*)(average+i), _mm_andnot_si128(hole, f16));
+    }
+    temporal_scalar(depth+i, average+i, out+i, count-i, weight, motion);
+}
+
+TARGET_SSE41 static void smooth_sse41(const unsigned short* in, unsigned short* out, int count, int step, int radius, int tolerance){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i t = _mm_set1_epi16((short)(tolerance*64));
+    int i = 0;
+    for(; i+8<=count; i+=8){
+        __m128i c = _mm_loadu_si128((const __m128i*)(in+i));
+        __m128i tol = _mm_mulhi_epu16(c, t);
+        __m128i sum_lo = zero, sum_hi = zero, n = zero, farthest = zero;
+        for(int k=-radius; k<=radius; k++){
+            __m128i d = _mm_loadu_si128((const __m128i*)(in+i+k*step));
+            farthest = _mm_max_epu16(farthest, d);
+            /// |d-c| <= tol, and d is a measurement
+            __m128i diff = _mm_sub_epi16(_mm_max_epu16(d,c), _mm_min_epu16(d,c));
+            __m128i close = _mm_cmpeq_epi16(_mm_min_epu16(diff, tol), diff);
+            __m128i use = _mm_andnot_si128(_mm_cmpeq_epi16(d, zero), close);
+            __m128i du = _mm_and_si128(d, use);
+            sum_lo = _mm_add_epi32(sum_lo, _mm_cvtepu16_epi32(du));
+            sum_hi = _mm_add_epi32(sum_hi, _mm_cvtepu16_epi32(_mm_srli_si128(du,8)));
+            n = _mm_sub_epi16(n, use);
+        }
+        n = _mm_max_epu16(n, one);
+        __m128 mean_lo = _mm_div_ps(_mm_cvtepi32_ps(sum_lo), _mm_cvtepi32_ps(_mm_cvtepu16_epi32(n)));
+        __m128 mean_hi = _mm_div_ps(_mm_cvtepi32_ps(sum_hi), _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(n,8))));
+        __m128i mean = _mm_packus_epi32(_mm_cvtps_epi32(mean_lo), _mm_cvtps_epi32(mean_hi));
+        _mm_storeu_si128((__m128i*)(out+i), _mm_blendv_epi8(mean, farthest, _mm_cmpeq_epi16(c, zero)));
+    }
+    smooth_scalar(in+i, out+i, count-i, step, radius, tolerance);
+}
+/// @}
+
+/// @{ AVX2, 16 pixels per iteration
+/// Same as store_xyz4 on both 128bit lanes, then the lanes are put back in order
+TARGET_AVX2 static inline void store_xyz8(float* out, __m256 x, __m256 y, __m256 z){
+    __m256 xy_lo = _mm256_unpacklo_ps(x, y);
+    __m256 xy_hi = _mm256_unpackhi_ps(x, y);
+    __m256 z0x1  = _mm256_shuffle_ps(z, x, _MM_SHUFFLE(1,1,0,0));
+    __m256 y1z1  = _mm256_shuffle_ps(y, z, _MM_SHUFFLE(1,1,1,1));
+    __m256 z2x3  = _mm256_shuffle_ps(z, x, _MM_SHUFFLE(3,3,2,2));
+    __m256 y3z3  = _mm256_shuffle_ps(y, z, _MM_SHUFFLE(3,3,3,3));
+    __m256 a = _mm256_shuffle_ps(xy_lo, z0x1, _MM_SHUFFLE(2,0,1,0)); ///< points 0-1 | 4-5
+    __m256 b = _mm256_shuffle_ps(y1z1, xy_hi, _MM_SHUFFLE(1,0,2,0)); ///< points 1-2 | 5-6
+    __m256 c = _mm256_shuffle_ps(z2x3, y3z3, _MM_SHUFFLE(2,0,2,0));  ///< points 2-3 | 6-7
+    _mm256_storeu_ps(out+0,  _mm256_permute2f128_ps(a, b, 0x20));
+    _mm256_storeu_ps(out+8,  _mm256_permute2f128_ps(c, a, 0x30));
+    _mm256_storeu_ps(out+16, _mm256_permute2f128_ps(b, c, 0x31));
+}
+
+TARGET_AVX2 static inline void extend8(__m256& lo, __m256& hi, __m256 v, __m256 empty){
+    lo = _mm256_min_ps(lo, _mm256_blendv_ps(v, _mm256_set1_ps(FLT_MAX), empty));
+    hi = _mm256_max_ps(hi, _mm256_blendv_ps(v, _mm256_set1_ps(-FLT_MAX), empty));
+}
+
+TARGET_AVX2 static void unproject_avx2(const unsigned short* depth, const float* raysX, const float* raysY, float* xyz, unsigned char* valid, float* bounds, int count){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one  = _mm_set1_epi8(1);
+    __m256 lo[3], hi[3];
+    for(int c=0; c<3; c++){
+        lo[c] = _mm256_set1_ps(FLT_MAX);
+        hi[c] = _mm256_set1_ps(-FLT_MAX);
+    }
+    int i = 0;
+    for(; i+16<=count; i+=16){
+        __m256i d16 = _mm256_loadu_si256((const __m256i*)(depth+i));
+        __m128i empty_lo = _mm_cmpeq_epi16(_mm256_castsi256_si128(d16), zero);
+        __m128i empty_hi = _mm_cmpeq_epi16(_mm256_extracti128_si256(d16,1), zero);
+        _mm_storeu_si128((__m128i*)(valid+i), _mm_add_epi8(_mm_packs_epi16(empty_lo, empty_hi), one));
+        __m256 e0 = _mm256_castsi256_ps(_mm256_cvtepi16_epi32(empty_lo));
+        __m256 e1 = _mm256_castsi256_ps(_mm256_cvtepi16_epi32(empty_hi));
+        __m256 d0 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(d16)));
+        __m256 d1 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(d16,1)));
+        __m256 x0 = _mm256_mul_ps(_mm256_loadu_ps(raysX+i),   d0), y0 = _mm256_mul_ps(_mm256_loadu_ps(raysY+i),   d0);
+        __m256 x1 = _mm256_mul_ps(_mm256_loadu_ps(raysX+i+8), d1), y1 = _mm256_mul_ps(_mm256_loadu_ps(raysY+i+8), d1);
+        store_xyz8(xyz+3*i,    x0, y0, d0);
+        store_xyz8(xyz+3*i+24, x1, y1, d1);
+        extend8(lo[0], hi[0], x0, e0); extend8(lo[0], hi[0], x1, e1);
+        extend8(lo[1], hi[1], y0, e0); extend8(lo[1], hi[1], y1, e1);
+        extend8(lo[2], hi[2], d0, e0); extend8(lo[2], hi[2], d1, e1);
+    }
+    float lanes_lo[24], lanes_hi[24];
+    for(int c=0; c<3; c++){
+        _mm256_storeu_ps(lanes_lo+8*c, lo[c]);
+        _mm256_storeu_ps(lanes_hi+8*c, hi[c]);
+    }
+    _mm256_zeroupper();
+    reset_bounds(bounds);
+    merge_lanes(lanes_lo, lanes_hi, 8, bounds);
+    unproject_tail(depth+i, raysX+i, raysY+i, xyz+3*i, valid+i, bounds, count-i);
+}
+/// @}
+
+/// @{ CPU feature detection
+static bool cpu_has_sse41(){
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1<<19)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+static bool cpu_has_avx2(){
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1<<27)) != 0;
+    bool avx     = (info[2] & (1<<28)) != 0;
+    if(!osxsave || !avx) return false;
+    /// The OS must save the YMM registers on context switches
+    if((_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1<<5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+/// @}
+#endif // KINECT_X86
+
+DepthKernels::DepthKernels(){
+    const char* forced = std::getenv("KINECT_SIMD");
+    bool any = (forced==NULL) || (forced[0]=='\0');
+
+    unproject = unproject_scalar;
+    temporal = temporal_scalar;
+    smooth = smooth_scalar;
+    _name = "scalar";
+#ifdef KINECT_X86
+    if((any || !std::strcmp(forced,"avx2")) && cpu_has_avx2()){
+        unproject = unproject_avx2;
+        temporal = temporal_sse41;
+        smooth = smooth_sse41;
+        _name = "avx2";
+    } else if((any || !std::strcmp(forced,"sse41")) && cpu_has_sse41()){
+        unproject = unproject_sse41;
+        temporal = temporal_sse41;
+        smooth = smooth_sse41;
+        _name = "sse41";
+    }
+#endif
+}
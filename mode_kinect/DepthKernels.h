@@ -0,0 +1,42 @@
+#pragma once
+
+/// Per-pixel kernels of the depth processing, in a scalar, an SSE4.1 and an
+/// AVX2 flavour. The flavour is picked at runtime from the features of the CPU,
+/// so one plugin binary runs on any x86 machine. Set the environment variable
+/// KINECT_SIMD to "scalar", "sse41" or "avx2" to force a flavour.
+class DepthKernels{
+public:
+    /// Converts "count" depth values into packed xyz points, multiplying them
+    /// by the per-pixel rays (x/z, y/z) of a DepthUnprojector. Pixels with zero
+    /// depth (no measurement) get a 0 in the validity mask, all others a 1.
+    /// The bounding box of the valid points is reduced on the way, into
+    /// bounds = {minx, miny, minz, maxx, maxy, maxz} (min > max if none is valid).
+    typedef void (*Unproject)(const unsigned short* depth, const float* raysX, const float* raysY,
+                              float* xyz, unsigned char* valid, float* bounds, int count);
+
+    /// Exponential average of the depth over time (see DepthFilter): the 
+    /// average moves by weight/256 of the way to the new depth, and restarts
+    /// from it where the depth changed by more than motion/1024 of itself.
+    /// Pixels without depth get the previous average for one frame, then 0.
+    /// "out" may be "depth".
+    typedef void (*Temporal)(const unsigned short* depth, unsigned short* average, unsigned short* out,
+                             int count, int weight, int motion);
+    /// One pass of an edge preserving smoothing along "step" (1 for a row, the
+    /// width for a column): out[i] averages the in[i+k*step], |k|<=radius, whose
+    /// depth is within tolerance/1024 of in[i]. Pixels without depth take the 
+    /// farthest depth around them, which fills the shadows of the sensor.
+    /// @note in[i-radius*step] to in[i+radius*step] must be readable
+    typedef void (*Smooth)(const unsigned short* in, unsigned short* out, int count, 
+                           int step, int radius, int tolerance);
+
+    DepthKernels();
+    /// Instruction set that was selected ("avx2", "sse41" or "scalar")
+    const char* name() const { return _name; }
+    Unproject unproject;
+    /// @note the AVX2 flavour uses the SSE4.1 filters, they are bound by memory
+    Temporal temporal;
+    Smooth smooth;
+
+private:
+    const char* _name;
+};
@@ -0,0 +1,36 @@
+#include "DepthUnprojector.h"
+#include <cmath>
+
+void DepthUnprojector::setup(openni::VideoStream& stream){
+    openni::VideoMode mode = stream.getVideoMode();
+    setup(mode.getResolutionX(), mode.getResolutionY(),
+          stream.getHorizontalFieldOfView(), stream.getVerticalFieldOfView());
+}
+
+void DepthUnprojector::setup(int width, int height, float hfov, float vfov){
+    /// Same factors OpenNI caches in its VideoStream for convertDepthToWorld
+    setupFactors(width, height, std::tan(hfov/2) * 2, std::tan(vfov/2) * 2);
+}
+
+bool DepthUnprojector::matches(int width, int height, float hfov, float vfov) const{
+    return matches(width, height) 
+        && _xzFactor==float(std::tan(hfov/2) * 2) && _yzFactor==float(std::tan(vfov/2) * 2);
+}
+
+void DepthUnprojector::setupFactors(int width, int height, float xzFactor, float yzFactor){
+    _width = width;
+    _height = height;
+    _xzFactor = xzFactor;
+    _yzFactor = yzFactor;
+    _raysX.resize(width*height);
+    _raysY.resize(width*height);
+
+    for(int y=0; y<height; y++){
+        float normalizedY = .5f - float(y)/height;
+        for(int x=0; x<width; x++){
+            float normalizedX = float(x)/width - .5f;
+            _raysX[y*width+x] = normalizedX * _xzFactor;
+            _raysY[y*width+x] = normalizedY * _yzFactor;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <vector>
+#include <QtGlobal>
+#include "OpenNI.h"
+#include "DepthKernels.h"
+#include "PointFrame.h"
+
+/// Converts depth pixels to world coordinates through a precomputed table of
+/// per-pixel rays (x/z, y/z). The table reproduces what
+/// CoordinateConverter::convertDepthToWorld does internally, but it is built
+/// once per video mode so that a frame becomes a single multiply pass.
+class DepthUnprojector{
+public:
+    DepthUnprojector() : _width(0), _height(0), _xzFactor(0), _yzFactor(0){}
+
+    /// Build the table from the current video mode and field of view of the stream
+    void setup(openni::VideoStream& stream);
+    /// Build the table for a resolution and a field of view (in radians)
+    void setup(int width, int height, float hfov, float vfov);
+    /// Build the table for a resolution and the image plane size at unit depth
+    void setupFactors(int width, int height, float xzFactor, float yzFactor);
+    /// Does the table match a frame of this size? (if not, call setup again)
+    bool matches(int width, int height) const { return (width==_width) && (height==_height); }
+    /// Does it also match this field of view? (the factors of setup() are compared)
+    bool matches(int width, int height, float hfov, float vfov) const;
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    /// Size of the image plane at unit depth (2*tan(fov/2)), as used by OpenNI
+    float xzFactor() const { return _xzFactor; }
+    float yzFactor() const { return _yzFactor; }
+    /// Rays of the pixels, row-major, scaled so that they have unit depth
+    const float* raysX() const { return _raysX.empty() ? NULL : &_raysX[0]; }
+    const float* raysY() const { return _raysY.empty() ? NULL : &_raysY[0]; }
+
+    /// Unprojects a whole frame into packed xyz points, their validity mask
+    /// and their bounding box
+    void unproject(const openni::DepthPixel* depth, PointFrame& points) const{
+        Q_ASSERT(points.width()==_width && points.height()==_height);
+        kernels.unproject(depth, raysX(), raysY(), points.xyz(), points.valid(), points.bounds(), _width*_height);
+    }
+    /// World coordinates of pixel (x,y) with depth d, same as convertDepthToWorld
+    void unproject(int x, int y, openni::DepthPixel d, float* wx, float* wy, float* wz) const{
+        int i = y*_width + x;
+        *wx = _raysX[i] * d;
+        *wy = _raysY[i] * d;
+        *wz = d;
+    }
+
+    /// Vectorized kernels for this CPU
+    DepthKernels kernels;
+
+private:
+    int _width;
+    int _height;
+    float _xzFactor;
+    float _yzFactor;
+    std::vector<float> _raysX; ///< x/z of every pixel
+    std::vector<float> _raysY; ///< y/z of every pixel
+};
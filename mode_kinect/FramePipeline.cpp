@@ -0,0 +1,91 @@
+#include "FramePipeline.h"
+#include <QRunnable>
+#include "KinectProfiler.h"
+
+/// Runs one stage on one job
+class FramePipelineTask : public QRunnable{
+public:
+    FramePipelineTask(FramePipeline* pipeline, int stage, FrameJobPtr job) :
+        pipeline(pipeline), stage(stage), job(job){}
+    void run(){ pipeline->run(stage, job); }
+private:
+    FramePipeline* pipeline;
+    int stage;
+    FrameJobPtr job;
+};
+
+FramePipeline::FramePipeline(QObject* parent) : QObject(parent),
+    _submitted(0), _completed(0), _dropped(0){}
+
+FramePipeline::~FramePipeline(){
+    _pool.waitForDone();
+    qDeleteAll(_stages);
+}
+
+void FramePipeline::addStage(FrameStage* stage){
+    QMutexLocker locker(&_mutex);
+    _stages.push_back(stage);
+    _lanes.resize(_stages.size());
+}
+
+void FramePipeline::submit(const KinectFrame& frame){
+    if(_stages.empty()) return;
+    {
+        QMutexLocker locker(&_mutex);
+        _submitted.fetchAndAddRelaxed(1);
+        if(_lanes[0].busy){
+            _dropped.fetchAndAddRelaxed(1);
+            return;
+        }
+        _lanes[0].busy = true;
+    }
+    
+    /// The lane is ours, copy outside of the lock
+    FrameJobPtr job(new FrameJob());
+    job->frame = frame;
+    _pool.start(new FramePipelineTask(this, 0, job));
+}
+
+void FramePipeline::schedule(int stage, FrameJobPtr job){
+    Lane& lane = _lanes[stage];
+    if(lane.busy){
+        if(lane.waiting) _dropped.fetchAndAddRelaxed(1);
+        lane.waiting = job;
+        return;
+    }
+    lane.busy = true;
+    _pool.start(new FramePipelineTask(this, stage, job));
+}
+
+void FramePipeline::run(int stage, FrameJobPtr job){
+    {
+        KinectProfiler::Scope scope(KinectProfiler::WORK, job->frame.points.sensor(), job->frame.points.index());
+        _stages[stage]->process(*job);
+    }
+    
+    QMutexLocker locker(&_mutex);
+    /// Move the job on (the last stage is serialized, so it is the only producer)
+    if(stage+1 < _stages.size()){
+        schedule(stage+1, job);
+    } else {
+        _results.back() = job;
+        _results.publish();
+        _completed.fetchAndAddOrdered(1);
+    }
+    
+    /// Then pick up the newest frame that arrived meanwhile
+    Lane& lane = _lanes[stage];
+    lane.busy = false;
+    if(lane.waiting){
+        FrameJobPtr next = lane.waiting;
+        lane.waiting.clear();
+        schedule(stage, next);
+    }
+}
+
+void FramePipeline::decorate(){
+    TripleBuffer<FrameJobPtr>::Reader result(_results);
+    if(!result.isValid()) return;
+    foreach(FrameStage* stage, _stages)
+        stage->decorate(**result);
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <QObject>
+#include <QList>
+#include <QVector>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QThreadPool>
+#include "FrameStage.h"
+#include "TripleBuffer.h"
+
+/// Runs FrameStages on frame snapshots in a pool of worker threads, away from 
+/// the GUI thread. Every stage handles one frame at a time, but consecutive 
+/// frames are pipelined (frame n+1 is filtered while frame n is segmented). 
+/// A stage that is busy keeps only the newest frame waiting for it, so a slow 
+/// stage drops frames instead of building up latency (the first stage drops 
+/// the frames submitted while it is busy, before copying them). Finished jobs 
+/// are published through a TripleBuffer, decorate() never waits for the workers.
+class FramePipeline : public QObject{
+    Q_OBJECT
+public:
+    FramePipeline(QObject* parent=0);
+    /// Waits for the running stages
+    ~FramePipeline();
+
+    /// Appends a stage, the pipeline takes ownership
+    /// @note register the stages before the first submit()
+    void addStage(FrameStage* stage);
+    const QList<FrameStage*>& stages() const { return _stages; }
+
+    /// Copies the frame and hands it to the first stage, or drops it if that
+    /// stage is busy (the frame is only copied if it is used)
+    /// @note GUI thread
+    void submit(const KinectFrame& frame);
+    /// Lets every stage draw the latest job that went through the pipeline
+    /// @note GUI thread
+    void decorate();
+
+    /// Blocks until every submitted job went through or was dropped
+    void waitForDone(){ _pool.waitForDone(); }
+
+    /// @{ counters since the start, safe to read from any thread
+    int submitted() const { return _submitted.fetchAndAddOrdered(0); }
+    int completed() const { return _completed.fetchAndAddOrdered(0); }
+    int dropped() const { return _dropped.fetchAndAddOrdered(0); }
+    /// @}
+
+private:
+    friend class FramePipelineTask;
+    /// Gives the job to a stage, or leaves it waiting if the stage is busy
+    /// @note lock _mutex first
+    void schedule(int stage, FrameJobPtr job);
+    /// Body of the worker tasks
+    void run(int stage, FrameJobPtr job);
+
+    struct Lane{
+        Lane() : busy(false){}
+        FrameJobPtr waiting; ///< newest job the stage didn't get to yet
+        bool busy;
+    };
+    QList<FrameStage*> _stages;
+    QVector<Lane> _lanes;
+    QMutex _mutex;       ///< guards _lanes, held only to hand over jobs
+    QThreadPool _pool;
+    TripleBuffer<FrameJobPtr> _results;
+    /// @{ bumped by the workers, read by anyone (mutable for the const reads)
+    mutable QAtomicInt _submitted;
+    mutable QAtomicInt _completed;
+    mutable QAtomicInt _dropped;
+    /// @}
+};
@@ -0,0 +1,103 @@
+#include "FrameRecorder.h"
+#include <cstring>
+#include <QDebug>
+
+FrameRecorder::FrameRecorder(int buffers){
+    _buffers.resize(qMax(2, buffers));
+    _colorWidth = _colorHeight = 0;
+    _closing = false;
+    _open = false;
+}
+
+FrameRecorder::~FrameRecorder(){
+    close();
+}
+
+bool FrameRecorder::open(const QString& path, int width, int height, int colorWidth, int colorHeight, float hfov, float vfov, int compression){
+    close();
+    if(!_writer.open(path, width, height, colorWidth, colorHeight, hfov, vfov, compression))
+        return false;
+
+    /// All the memory is taken now, push() only copies
+    _colorWidth = colorWidth;
+    _colorHeight = colorHeight;
+    _free.clear();
+    _queued.clear();
+    for(int i=0; i<_buffers.size(); i++){
+        _buffers[i].depth.resize(width*height);
+        _buffers[i].color.resize(3*colorWidth*colorHeight);
+        _free.push_back(i);
+    }
+    _written = 0;
+    _dropped = 0;
+    _closing = false;
+    _open = true;
+    start(QThread::LowPriority);
+    return true;
+}
+
+void FrameRecorder::close(){
+    if(!_open) return;
+    {
+        QMutexLocker locker(&_mutex);
+        _closing = true;
+        _wake.wakeOne();
+    }
+    wait();
+    _writer.close();
+    _open = false;
+    if(_dropped) qDebug() << "FrameRecorder: dropped" << int(_dropped) << "frames, the disk did not keep up";
+}
+
+bool FrameRecorder::push(quint64 timestamp, int index, const openni::DepthPixel* depth, const uchar* color, int colorStride){
+    if(!_open) return false;
+    int slot;
+    {
+        QMutexLocker locker(&_mutex);
+        if(_free.isEmpty()){
+            _dropped.ref();
+            return false;
+        }
+        slot = _free.takeFirst();
+    }
+
+    /// Copied outside of the lock, the writer keeps going meanwhile
+    Buffer& buffer = _buffers[slot];
+    buffer.timestamp = timestamp;
+    buffer.index = index;
+    std::copy(depth, depth + buffer.depth.size(), buffer.depth.begin());
+    int lineBytes = 3*_colorWidth;
+    if(colorStride==0 || colorStride==lineBytes){
+        std::memcpy(&buffer.color[0], color, buffer.color.size());
+    } else {
+        for(int y=0; y<_colorHeight; y++)
+            std::memcpy(&buffer.color[y*lineBytes], color + y*colorStride, lineBytes);
+    }
+
+    QMutexLocker locker(&_mutex);
+    _queued.push_back(slot);
+    _wake.wakeOne();
+    return true;
+}
+
+void FrameRecorder::run(){
+    forever{
+        int slot;
+        {
+            QMutexLocker locker(&_mutex);
+            while(_queued.isEmpty() && !_closing)
+                _wake.wait(&_mutex);
+            if(_queued.isEmpty()) return; ///< closing, and everything was written
+            slot = _queued.takeFirst();
+        }
+
+        const Buffer& buffer = _buffers[slot];
+        if(_writer.write(buffer.timestamp, buffer.index, &buffer.depth[0], &buffer.color[0]))
+            _written.ref();
+        else
+            _dropped.ref();
+
+        QMutexLocker locker(&_mutex);
+        _free.push_back(slot);
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QVector>
+#include <QList>
+#include "RawFrameFile.h"
+
+/// Records synchronized depth/color pairs to a .kraw file from a thread of
+/// its own. push() copies a frame into one of a fixed pool of buffers and
+/// returns, the writer thread compresses and writes the buffers in order.
+/// When the disk falls behind and no buffer is free, frames are dropped (and
+/// counted) rather than making the caller wait, memory stays bounded.
+class FrameRecorder : public QThread{
+public:
+    FrameRecorder(int buffers=8);
+    /// Closes the file
+    ~FrameRecorder();
+
+    /// Starts a recording, the images pushed must have these sizes
+    bool open(const QString& path, int width, int height, int colorWidth, int colorHeight, float hfov, float vfov,
+              int compression=RawFrameFile::DEPTH_DELTA);
+    /// Writes the frames still queued, then closes the file
+    void close();
+    bool isOpen() const { return _open; }
+
+    /// Queues a copy of the frame (colorStride: bytes per line, 0 if packed)
+    /// Returns false if it was dropped, no buffer being free
+    /// @note never waits for the disk, call from one thread at a time
+    bool push(quint64 timestamp, int index, const openni::DepthPixel* depth, const uchar* color, int colorStride=0);
+
+    /// @{ counters of the current recording
+    int written() const { return _written; }
+    int dropped() const { return _dropped; }
+    /// @}
+
+protected:
+    /// Writes the queued buffers until close()
+    void run();
+
+private:
+    struct Buffer{
+        quint64 timestamp;
+        int index;
+        std::vector<openni::DepthPixel> depth;
+        std::vector<uchar> color; ///< packed
+    };
+    RawFrameWriter _writer;       ///< writer thread, while open
+    QVector<Buffer> _buffers;
+    int _colorWidth, _colorHeight;
+    QList<int> _free;             ///< buffers push() may fill
+    QList<int> _queued;           ///< buffers to write, oldest first
+    QMutex _mutex;                ///< guards _free, _queued and _closing
+    QWaitCondition _wake;         ///< a buffer was queued, or close()
+    bool _closing;
+    bool _open;
+    QAtomicInt _written;
+    QAtomicInt _dropped;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <QString>
+#include <QVector>
+#include <QVariant>
+#include <QHash>
+#include <QSharedPointer>
+#include <QtConcurrentMap>
+#include "KinectFrame.h"
+
+/// A frame travelling through a FramePipeline: a private copy of the sensor
+/// frame (stages may modify it) plus whatever the stages want to hand to the
+/// following stages or to decorate(), keyed by name
+struct FrameJob{
+    KinectFrame frame;
+    QVariantHash results;
+    /// Coarser copies of frame.points, filled by a DecimationStage
+    QVector<PointFrame> levels;
+    /// The points at a level of detail: 0 is the full resolution, and
+    /// requests past the coarsest level get the coarsest one
+    const PointFrame& points(int level=0) const {
+        if(level<=0 || levels.isEmpty()) return frame.points;
+        return levels[qMin(level, levels.size())-1];
+    }
+};
+typedef QSharedPointer<FrameJob> FrameJobPtr;
+
+/// A step of the per-frame processing (filter, segment, track, ...)
+/// Register it with FramePipeline::addStage()
+class FrameStage{
+public:
+    virtual ~FrameStage(){}
+    virtual QString name() const = 0;
+    /// Runs on a worker thread, never concurrently with itself. Frames come
+    /// in order, but the pipeline may skip some to keep up with the sensor
+    virtual void process(FrameJob& job) = 0;
+    /// Runs in the GUI thread (with the GL context) for the latest job that 
+    /// went through the whole pipeline
+    virtual void decorate(const FrameJob& job){ Q_UNUSED(job); }
+
+public:
+    /// Calls kernel(begin, end) on tiles of "tile" rows of [0,rows) in parallel,
+    /// returns once all of them are done (also used outside of the pipeline)
+    template <class Kernel>
+    static void forEachRowTile(int rows, const Kernel& kernel, int tile=32){
+        QVector< QPair<int,int> > tiles;
+        for(int begin=0; begin<rows; begin+=tile)
+            tiles.push_back( qMakePair(begin, qMin(rows, begin+tile)) );
+        QtConcurrent::blockingMap(tiles, TileFunctor<Kernel>(kernel));
+    }
+
+private:
+    template <class Kernel>
+    struct TileFunctor{
+        typedef void result_type;
+        TileFunctor(const Kernel& kernel) : kernel(kernel){}
+        void operator()(QPair<int,int>& tile) const { kernel(tile.first, tile.second); }
+        const Kernel& kernel;
+    };
+};
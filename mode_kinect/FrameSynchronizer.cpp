@@ -0,0 +1,96 @@
+#include "FrameSynchronizer.h"
+#include <QDebug>
+#include "KinectProfiler.h"
+
+FrameSynchronizer::FrameSynchronizer(int capacity){
+    _capacity = qMax(1, capacity);
+    _sensor = -1;
+    _by = MATCH_INDEX;
+    _tolerance = 0;
+    _matched = 0;
+    _droppedDepth = 0;
+    _droppedColor = 0;
+}
+
+void FrameSynchronizer::setCapacity(int capacity){
+    QMutexLocker locker(&_mutex);
+    _capacity = qMax(1, capacity);
+    while(_depth.size()>_capacity){ _depth.dequeue(); _droppedDepth++; }
+    while(_color.size()>_capacity){ _color.dequeue(); _droppedColor++; }
+}
+
+void FrameSynchronizer::setMatching(MatchBy by, quint64 tolerance){
+    QMutexLocker locker(&_mutex);
+    _by = by;
+    _tolerance = tolerance;
+}
+
+bool FrameSynchronizer::matches(const VideoFrameRef& depth, const VideoFrameRef& color) const{
+    quint64 a, b;
+    if(_by == MATCH_INDEX){
+        a = depth.getFrameIndex();
+        b = color.getFrameIndex();
+    } else {
+        a = depth.getTimestamp();
+        b = color.getTimestamp();
+    }
+    return (a>b ? a-b : b-a) <= _tolerance;
+}
+
+void FrameSynchronizer::push(QQueue<VideoFrameRef>& queue, const VideoFrameRef& frame, int& dropped){
+    ProfiledMutexLocker locker(&_mutex, _sensor);
+    /// Drop the oldest, this releases its OpenNI buffer
+    if(queue.size() == _capacity){
+        queue.dequeue();
+        dropped++;
+    }
+    queue.enqueue(frame);
+}
+
+void FrameSynchronizer::pushDepth(const VideoFrameRef& frame){
+    push(_depth, frame, _droppedDepth);
+}
+
+void FrameSynchronizer::pushColor(const VideoFrameRef& frame){
+    push(_color, frame, _droppedColor);
+}
+
+bool FrameSynchronizer::take(VideoFrameRef* depth, VideoFrameRef* color){
+    ProfiledMutexLocker locker(&_mutex, _sensor);
+
+    /// Newest depth frame that has a partner (queues are tiny)
+    for(int d=_depth.size()-1; d>=0; d--){
+        for(int c=_color.size()-1; c>=0; c--){
+            if(!matches(_depth[d], _color[c])) continue;
+            *depth = _depth[d];
+            *color = _color[c];
+            /// Whatever is older than the pair will never be used
+            _droppedDepth += d;
+            _droppedColor += c;
+            _depth.erase(_depth.begin(), _depth.begin()+d+1);
+            _color.erase(_color.begin(), _color.begin()+c+1);
+            _matched++;
+            return true;
+        }
+    }
+    return false;
+}
+
+int FrameSynchronizer::queuedDepth() const{
+    QMutexLocker locker(&_mutex);
+    return _depth.size();
+}
+
+int FrameSynchronizer::queuedColor() const{
+    QMutexLocker locker(&_mutex);
+    return _color.size();
+}
+
+void FrameSynchronizer::status() const{
+    QMutexLocker locker(&_mutex);
+    int depthItem = _depth.empty() ? -1 : _depth.head().getFrameIndex();
+    int colorItem = _color.empty() ? -1 : _color.head().getFrameIndex();
+    qDebug() << "SIZE D#" << _depth.size() << "C#" << _color.size();
+    qDebug() << "HEAD D#" << depthItem << "C#" << colorItem;
+    qDebug() << "MATCHED" << _matched << "DROPPED D#" << _droppedDepth << "C#" << _droppedColor;
+}
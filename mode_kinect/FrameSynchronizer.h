@@ -0,0 +1,58 @@
+#pragma once
+#include <QQueue>
+#include <QMutex>
+#include "OpenNI.h"
+
+/// Pairs depth and color frames of the same instant. Each stream keeps at most
+/// capacity() frames: when a stream gets ahead of the consumer its oldest frame
+/// is dropped, so neither memory nor latency grow with a slow consumer. take()
+/// always returns the newest matching pair and discards everything older.
+/// Frames match by index, or by timestamp, within a tolerance.
+/// @note push*() and take() may be called from different threads
+class FrameSynchronizer{
+public:
+    typedef openni::VideoFrameRef VideoFrameRef;
+    enum MatchBy{ MATCH_INDEX, MATCH_TIMESTAMP };
+
+    /// By default frames match only if they have the same index
+    FrameSynchronizer(int capacity=2);
+    /// Frames kept per stream (>=1), the latency bound in frames
+    void setCapacity(int capacity);
+    int capacity() const { return _capacity; }
+    /// Tolerance is in frames for MATCH_INDEX, in microseconds for MATCH_TIMESTAMP
+    void setMatching(MatchBy by, quint64 tolerance=0);
+    /// Sensor the lock waits are accounted to, see KinectProfiler
+    void setSensor(int sensor){ _sensor = sensor; }
+
+    void pushDepth(const VideoFrameRef& frame);
+    void pushColor(const VideoFrameRef& frame);
+    /// Newest matching pair, or false if there is none yet
+    bool take(VideoFrameRef* depth, VideoFrameRef* color);
+
+    /// @{ counters since the start
+    int matched() const { return _matched; }
+    int droppedDepth() const { return _droppedDepth; }
+    int droppedColor() const { return _droppedColor; }
+    int dropped() const { return _droppedDepth + _droppedColor; }
+    /// @}
+    /// @{ frames waiting to be matched
+    int queuedDepth() const;
+    int queuedColor() const;
+    /// @}
+    /// debugging helper
+    void status() const;
+
+private:
+    bool matches(const VideoFrameRef& depth, const VideoFrameRef& color) const;
+    void push(QQueue<VideoFrameRef>& queue, const VideoFrameRef& frame, int& dropped);
+    mutable QMutex _mutex;
+    QQueue<VideoFrameRef> _depth; ///< oldest first
+    QQueue<VideoFrameRef> _color; ///< oldest first
+    int _capacity;
+    int _sensor; ///< -1
+    MatchBy _by;
+    quint64 _tolerance;
+    int _matched;
+    int _droppedDepth;
+    int _droppedColor;
+};
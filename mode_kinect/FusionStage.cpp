@@ -0,0 +1,140 @@
+#include "FusionStage.h"
+
+FusionStage::FusionStage(float voxelSize, int interval) : _volume(voxelSize){
+    _interval = interval;
+    _pose.setIdentity();
+    clear_surface();
+}
+
+void FusionStage::setModel(SurfaceMeshModel* model){
+    _model = model;
+    _enabled = (model!=NULL);
+}
+
+void FusionStage::reset(){
+    _resetRequested = 1;
+}
+
+void FusionStage::setPose(const Eigen::Matrix4f& pose){
+    QMutexLocker locker(&_mutex);
+    _pose = pose;
+}
+
+void FusionStage::process(FrameJob& job){
+    if(_resetRequested.fetchAndStoreOrdered(0)){
+        _volume.reset();
+        clear_surface();
+        _extracted = QTime();
+    }
+    if(!_enabled) return;
+
+    /// Only the depth is needed, it works with GPU unprojection as well
+    _volume.integrate(job.points());
+    if(!_extracted.isNull() && _extracted.elapsed() < _interval) return;
+    _extracted.start();
+
+    /// Only the blocks that changed are triangulated again, and only their
+    /// faces are replaced
+    QVector<TsdfVolume::Key> changed;
+    if(!_volume.extract(&changed)) return;
+    /// Deleted faces stay in the arrays of the mesh, start over once they
+    /// outnumber the others
+    if(_surface.faces_size() > 2*_surface.n_faces() + 4096){
+        clear_surface();
+        changed = QVector<TsdfVolume::Key>::fromList(_volume.blocks());
+    }
+    update_surface(changed);
+
+    /// The copy for the model, without the deleted elements and in scene
+    /// coordinates, is made here too, away from the GUI
+    QSharedPointer<Surface_mesh> mesh(new Surface_mesh(_surface));
+    mesh->garbage_collection();
+    Eigen::Matrix4f pose;
+    {
+        QMutexLocker locker(&_mutex);
+        pose = _pose;
+    }
+    if(!pose.isIdentity()){
+        Surface_mesh::Vertex_property<Surface_mesh::Point> points = mesh->get_vertex_property<Surface_mesh::Point>("v:point");
+        for(unsigned int v=0; v<mesh->n_vertices(); v++){
+            Surface_mesh::Point& p = points[Surface_mesh::Vertex(v)];
+            Eigen::Vector4f q = pose * Eigen::Vector4f(p.x(), p.y(), p.z(), 1);
+            p = Surface_mesh::Point(q.x(), q.y(), q.z());
+        }
+    }
+    mesh->update_face_normals();
+    mesh->update_vertex_normals();
+
+    QMutexLocker locker(&_mutex);
+    _mesh = mesh;
+}
+
+void FusionStage::update_surface(const QVector<TsdfVolume::Key>& changed){
+    /// Drop the faces of the blocks first, the new ones may take the same edges
+    std::vector<Surface_mesh::Vertex> dropped;
+    foreach(const TsdfVolume::Key& key, changed){
+        std::vector<Surface_mesh::Face>& faces = _surfaceFaces[key];
+        for(size_t f=0; f<faces.size(); f++){
+            Surface_mesh::Halfedge h = _surface.halfedge(faces[f]);
+            for(int k=0; k<3; k++, h=_surface.next_halfedge(h))
+                dropped.push_back(_surface.to_vertex(h));
+            _surface.delete_face(faces[f]);
+        }
+        faces.clear();
+    }
+
+    _surfaceVertices.resize(_volume.vertices().size());
+    std::vector<int> triangles;
+    foreach(const TsdfVolume::Key& key, changed){
+        _volume.triangles(key, triangles);
+        std::vector<Surface_mesh::Face>& faces = _surfaceFaces[key];
+        for(size_t t=0; t<triangles.size(); t+=3){
+            Surface_mesh::Face f = _surface.add_triangle(surface_vertex(triangles[t]),
+                                                         surface_vertex(triangles[t+1]),
+                                                         surface_vertex(triangles[t+2]));
+            if(f.is_valid()) faces.push_back(f);
+        }
+    }
+
+    /// Vertices no face uses any more
+    for(size_t v=0; v<dropped.size(); v++)
+        if(!_surface.is_deleted(dropped[v]) && _surface.is_isolated(dropped[v]))
+            _surface.delete_vertex(dropped[v]);
+}
+
+Surface_mesh::Vertex FusionStage::surface_vertex(int i){
+    const Eigen::Vector3f& p = _volume.vertices()[i];
+    Surface_mesh::Vertex& v = _surfaceVertices[i];
+    /// The slot may have been given to another vertex, or the crossing moved
+    if(!v.is_valid() || _surface.is_deleted(v))
+        v = _surface.add_vertex(Surface_mesh::Point(p.x(), p.y(), p.z()));
+    else
+        _surfacePoints[v] = Surface_mesh::Point(p.x(), p.y(), p.z());
+    return v;
+}
+
+void FusionStage::clear_surface(){
+    _surface.clear();
+    _surfacePoints = _surface.get_vertex_property<Surface_mesh::Point>("v:point");
+    _surfaceVertices.clear();
+    _surfaceFaces.clear();
+}
+
+void FusionStage::decorate(const FrameJob& job){
+    Q_UNUSED(job);
+    if(!_model){
+        _enabled = 0; ///< removed from the document
+        return;
+    }
+
+    QSharedPointer<Surface_mesh> mesh;
+    {
+        QMutexLocker locker(&_mutex);
+        if(!_mesh) return;
+        mesh.swap(_mesh);
+    }
+
+    /// A copy of the property arrays, no mesh operations on the GUI thread
+    _model->Surface_mesh::operator=(*mesh);
+    _model->updateBoundingBox();
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <QAtomicInt>
+#include <QMutex>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QTime>
+#include "SurfaceMeshModel.h"
+#include "FrameStage.h"
+#include "TsdfVolume.h"
+
+/// Fuses the frames into a TsdfVolume and keeps a SurfaceMeshModel in sync
+/// with its surface, which grows into a scan that can be saved. Integration
+/// happens in the worker thread for every frame the stage gets; about once a
+/// second the blocks that changed are triangulated again, and only their
+/// faces are replaced in a mesh the worker keeps. A compact copy of it (with
+/// its normals) is made in the worker as well; decorate() only assigns it to
+/// the model in the GUI thread.
+/// Acquisition never waits for it, frames arriving meanwhile are dropped by
+/// the pipeline.
+/// @note the sensor must not move, frames are fused without tracking. Only
+/// the frames of the primary sensor go through the pipeline: they are fused
+/// as seen from the sensor, and the mesh is placed in the scene by the
+/// extrinsic of the sensor (see setPose).
+class FusionStage : public FrameStage{
+public:
+    FusionStage(float voxelSize=10, int interval=1000);
+    QString name() const { return "Fusion"; }
+    void process(FrameJob& job);
+    void decorate(const FrameJob& job);
+
+/// @{ GUI thread
+    /// Starts fusing into the model (already in the document), NULL stops
+    void setModel(SurfaceMeshModel* model);
+    SurfaceMeshModel* model() const { return _model; }
+    /// Forgets what was fused so far
+    void reset();
+    /// Extrinsic of the sensor the frames come from, applied to the next meshes
+    void setPose(const Eigen::Matrix4f& pose);
+/// @}
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+private:
+    /// @{ worker thread
+    /// Replaces the faces of the blocks in _surface
+    void update_surface(const QVector<TsdfVolume::Key>& changed);
+    /// Vertex of _surface for vertex i of the volume, added or moved
+    Surface_mesh::Vertex surface_vertex(int i);
+    void clear_surface();
+    /// @}
+
+    TsdfVolume _volume;  ///< worker thread
+    int _interval;       ///< ms between mesh updates
+    QTime _extracted;    ///< last mesh update (worker thread)
+    /// @{ the surface as seen from the sensor, updated block by block (worker thread)
+    Surface_mesh _surface;
+    Surface_mesh::Vertex_property<Surface_mesh::Point> _surfacePoints;
+    std::vector<Surface_mesh::Vertex> _surfaceVertices; ///< of each vertex of the volume
+    QHash<TsdfVolume::Key, std::vector<Surface_mesh::Face> > _surfaceFaces; ///< of each block
+    /// @}
+    QAtomicInt _enabled;
+    QAtomicInt _resetRequested;
+
+    /// @{ latest mesh, from the worker to decorate(), NULL once shown
+    QMutex _mutex;
+    QSharedPointer<Surface_mesh> _mesh;
+    Eigen::Matrix4f _pose; ///< also guarded by _mutex
+    /// @}
+
+    QPointer<SurfaceMeshModel> _model;
+};
@@ -0,0 +1,172 @@
+#include "GpuCloudRenderer.h"
+#include <QtOpenGL>
+#include <QDebug>
+
+/// Same formula as DepthUnprojector (and OpenNI's convertDepthToWorld).
+/// Pixels without depth are moved outside of the clipping volume.
+static const char* vertex_shader =
+    "#version 120\n"
+    "uniform sampler2D depthMap;\n"
+    "uniform sampler2D colorMap;\n"
+    "uniform vec2 resolution;\n"
+    "uniform vec2 factors;\n"
+    "attribute vec2 pixel;\n"
+    "varying vec3 color;\n"
+    "void main(){\n"
+    "    vec2 uv = (pixel + 0.5) / resolution;\n"
+    "    float d = floor(texture2DLod(depthMap, uv, 0.0).r * 65535.0 + 0.5);\n"
+    "    color = texture2DLod(colorMap, uv, 0.0).rgb;\n"
+    "    if(d == 0.0){\n"
+    "        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+    "        return;\n"
+    "    }\n"
+    "    vec2 normalized = vec2(pixel.x/resolution.x - 0.5, 0.5 - pixel.y/resolution.y);\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(normalized * factors * d, d, 1.0);\n"
+    "}\n";
+
+static const char* fragment_shader =
+    "#version 120\n"
+    "varying vec3 color;\n"
+    "void main(){\n"
+    "    gl_FragColor = vec4(color, 1.0);\n"
+    "}\n";
+
+/// glActiveTexture is not part of OpenGL 1.1, so it must be resolved at runtime
+typedef void (APIENTRY *ActiveTexture)(GLenum);
+static void activeTexture(GLenum unit){
+    static ActiveTexture function = (ActiveTexture) QGLContext::currentContext()->getProcAddress("glActiveTexture");
+    if(function) function(unit);
+}
+
+GpuCloudRenderer::GpuCloudRenderer() : _grid(QGLBuffer::VertexBuffer){
+    _program = NULL;
+    _depthTexture = 0;
+    _colorTexture = 0;
+    _width = 0;
+    _height = 0;
+    _stride = 1;
+    _count = 0;
+    _uploaded_index = -1;
+    _failed = false;
+}
+
+GpuCloudRenderer::~GpuCloudRenderer(){
+    /// Without a context the textures go away with it
+    if(QGLContext::currentContext() && _depthTexture){
+        glDeleteTextures(1, &_depthTexture);
+        glDeleteTextures(1, &_colorTexture);
+    }
+    delete _program;
+}
+
+bool GpuCloudRenderer::initialize(){
+    _program = new QGLShaderProgram();
+    _program->addShaderFromSourceCode(QGLShader::Vertex, vertex_shader);
+    _program->addShaderFromSourceCode(QGLShader::Fragment, fragment_shader);
+    if(!_program->link()){
+        qDebug() << "GpuCloudRenderer: " << _program->log();
+        return false;
+    }
+
+    glGenTextures(1, &_depthTexture);
+    glGenTextures(1, &_colorTexture);
+    GLuint textures[2] = {_depthTexture, _colorTexture};
+    for(int i=0; i<2; i++){
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        /// Exact texel lookups, no mipmaps
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    _grid.create();
+    _grid.setUsagePattern(QGLBuffer::StaticDraw);
+    return true;
+}
+
+void GpuCloudRenderer::build_grid(int stride){
+    _stride = stride;
+    std::vector<float> pixels;
+    pixels.reserve(2*_width*_height);
+    for(int y=0; y<_height; y+=stride){
+        for(int x=0; x<_width; x+=stride){
+            pixels.push_back(x);
+            pixels.push_back(y);
+        }
+    }
+    _count = pixels.size()/2;
+    _grid.bind();
+    _grid.allocate(&pixels[0], pixels.size()*sizeof(float));
+    _grid.release();
+}
+
+void GpuCloudRenderer::resize(int width, int height){
+    _width = width;
+    _height = height;
+    build_grid(_stride);
+
+    glBindTexture(GL_TEXTURE_2D, _depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE16, width, height, 0, GL_LUMINANCE, GL_UNSIGNED_SHORT, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void GpuCloudRenderer::upload(const PointFrame& frame, const QImage& color){
+    if(frame.width()!=_width || frame.height()!=_height)
+        resize(frame.width(), frame.height());
+
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, _depthTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _width, _height, GL_LUMINANCE, GL_UNSIGNED_SHORT, frame.depth());
+
+    /// Registered color, or plain red (like the CPU path) if there is none
+    glBindTexture(GL_TEXTURE_2D, _colorTexture);
+    if(color.format()==QImage::Format_RGB888){
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, color.bytesPerLine()/3);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, color.width(), color.height(), 0, GL_RGB, GL_UNSIGNED_BYTE, color.bits());
+    } else {
+        const unsigned char red[3] = {255,0,0};
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, red);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPopClientAttrib();
+
+    _uploaded_index = frame.index();
+}
+
+void GpuCloudRenderer::draw(const PointFrame& frame, const QImage& color, int stride){
+    if(frame.empty() || _failed) return;
+    if(!_program && !initialize()){
+        _failed = true;
+        return;
+    }
+
+    /// Repaints of the same frame reuse what is on the GPU already
+    if(frame.index() != _uploaded_index)
+        upload(frame, color);
+    if(qMax(1, stride) != _stride)
+        build_grid(qMax(1, stride));
+
+    _program->bind();
+    activeTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _depthTexture);
+    activeTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, _colorTexture);
+    _program->setUniformValue("depthMap", 0);
+    _program->setUniformValue("colorMap", 1);
+    _program->setUniformValue("resolution", QVector2D(_width, _height));
+    _program->setUniformValue("factors", QVector2D(frame.xzFactor(), frame.yzFactor()));
+
+    int pixel = _program->attributeLocation("pixel");
+    _grid.bind();
+    _program->enableAttributeArray(pixel);
+    _program->setAttributeBuffer(pixel, GL_FLOAT, 0, 2);
+    glDrawArrays(GL_POINTS, 0, _count);
+    _program->disableAttributeArray(pixel);
+    _grid.release();
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    activeTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    _program->release();
+}
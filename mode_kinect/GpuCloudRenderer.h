@@ -0,0 +1,38 @@
+#pragma once
+#include <QGLBuffer>
+#include <QGLShaderProgram>
+#include <QImage>
+#include "PointFrame.h"
+
+/// Draws a PointFrame that was not unprojected on the CPU. The raw 16bit depth
+/// image is uploaded as a texture (~600KB per VGA frame instead of ~3.6MB of
+/// points), and a vertex shader rebuilds the world points from a static grid
+/// of pixels and the intrinsics of the camera. Points are colored by sampling
+/// the registered color frame. Textures are refreshed only once per frame.
+/// A stride draws every stride-th pixel of every stride-th row (see 
+/// CloudRenderer::levelOfDetail), the textures stay at full resolution.
+/// @note must be used from the thread owning the GL context
+class GpuCloudRenderer{
+public:
+    GpuCloudRenderer();
+    ~GpuCloudRenderer();
+    /// Uploads depth and color if the frame was not uploaded already, then draws
+    void draw(const PointFrame& frame, const QImage& color, int stride=1);
+
+private:
+    bool initialize();
+    void resize(int width, int height);
+    /// Fills _grid with the pixels drawn at this stride
+    void build_grid(int stride);
+    void upload(const PointFrame& frame, const QImage& color);
+    QGLShaderProgram* _program;
+    QGLBuffer _grid;       ///< (x,y) of the drawn pixels, only changes with the resolution or the stride
+    GLuint _depthTexture;
+    GLuint _colorTexture;
+    int _width;
+    int _height;
+    int _stride;           ///< of _grid
+    int _count;            ///< points in _grid
+    int _uploaded_index;   ///< index of the frame in the textures
+    bool _failed;          ///< shaders didn't compile, don't try again
+};
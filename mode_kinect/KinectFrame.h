@@ -0,0 +1,9 @@
+#pragma once
+#include "PointFrame.h"
+#include "ColorFrame.h"
+
+/// Registered depth and color of the same sensor frame
+struct KinectFrame{
+    PointFrame points;
+    ColorFrame color;
+};
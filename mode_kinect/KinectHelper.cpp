@@ -1,6 +1,9 @@
 #include "KinectHelper.h"
+#include "FramePipeline.h"
 #include "OpenNI.h"
 #include "Starlab.h"
+#include <climits>
+#include <QRunnable>
 
 //#define DEBUG_QUEUE
 #ifdef DEBUG_QUEUE
@@ -11,91 +14,211 @@
     #define DEBUG_QUEUE if(0)
 #endif
 
-KinectHelper::KinectHelper(QObject *parent) : QObject(parent){
-    /// Initialize and open device, create depth stream
-    /// NOTE: by doing this in the constructor it remains in the main thread,
-    /// so the plugin will lock until Kinect is initialized
-    bool success = initialize_device();
-    if(!success) 
-        throw StarlabException("Failed to initialize Kinect");
+KinectHelper::KinectHelper(QObject *parent, QString uri) : QObject(parent), uri(uri){
+    raw_next = 0;
+    raw_start = 0;
+    raw_playing = false;
+    raw_due = -1;
+    playback_mode = PLAYBACK_REALTIME;
+    is_open = false;
+    pool = NULL;
+    _extrinsic.setIdentity();
+    openni_acquired = false;
+    
+    /// Helpers are numbered in the order they are made
+    static QAtomicInt created;
+    sensor_id = created.fetchAndAddRelaxed(1);
+    _synchronizer.setSensor(sensor_id);
 
     /// GUI Elements
     widget = NULL;
     colorLabel = NULL;
     
-    /// Instantiate listeners
+    /// Instantiate listeners, they are attached to the streams by open()
     depthListener = new ModeKinectListener(this);
     colorListener = new ModeKinectListener(this);
-    depth.addNewFrameListener(depthListener);
-    color.addNewFrameListener(colorListener);
        
-    /// Buffer pointers always valid
-    points_front_buffer = &points_buffer_1;
-    points_back_buffer  = &points_buffer_2;
-    color_front_buffer = &color_buffer_1;
-    color_back_buffer = &color_buffer_2;
+    points_legacy_index = -1;
+    color_legacy_index = -1;
+    color_label_index = -1;
+    
+    /// Unproject on the CPU unless asked otherwise
+    gpu_unprojection = false;
+    estimate_normals = false;
+    max_stride = 8;
+           
+    /// Allow passing VideoFrameRefs
+    qRegisterMetaType<VideoFrameRef>("VideoFrameRef");///< Allow pass reference frame as signals
+    qRegisterMetaType<BBox3>("BBox3");
+}
+
+bool KinectHelper::open(){
+    if(is_open) return true;
+    
+    /// Initialize and open device, create depth stream
+    /// NOTE: this takes seconds, run it in the kinect thread
+    bool success = RawFrameFile::isRawFile(uri) ? initialize_raw(uri) : initialize_device(uri);
+    if(!success){
+        emit failed("Failed to initialize Kinect");
+        return false;
+    }
     
-    /// Avoid displaying stuff when data is not ready
-    has_consumed_first_frame = false;
+    /// Raw dumps are played by play_raw instead
+    if(!raw_source){
+        depth.addNewFrameListener(depthListener);
+        color.addNewFrameListener(colorListener);
+    }
     
     ///Initialize the data sizes
     {
+        emit progress("Kinect: waiting for the first frame");
+        int width, height;
         VideoFrameRef frame;
-        Status status = depth.readFrame(&frame);
-        if(!status == STATUS_OK) 
-            throw StarlabException("Failed to initialize Kinect");
+        if(raw_source){
+            width = raw_source->header().width;
+            height = raw_source->header().height;
+            depth_hfov = raw_source->header().hfov;
+            depth_vfov = raw_source->header().vfov;
+        } else {
+            Status status = depth.readFrame(&frame);
+            if(status != STATUS_OK){
+                emit failed("Failed to read from Kinect");
+                return false;
+            }
+            width = frame.getWidth();
+            height = frame.getHeight();
+            depth_hfov = depth.getHorizontalFieldOfView();
+            depth_vfov = depth.getVerticalFieldOfView();
+            depth_mode = frame.getVideoMode();
+        }
+        
+        /// Rays of the depth stream for the current video mode
+        unprojector.setup(width, height, depth_hfov, depth_vfov);
         
         /// Allocate memory
-        points_buffer_1.resize(frame.getHeight(), frame.getWidth());
-        points_buffer_2.resize(frame.getHeight(), frame.getWidth());
-        color_buffer_1 = QImage(frame.getWidth(),frame.getHeight(),QImage::Format_RGB888);
-        color_buffer_2 = QImage(frame.getWidth(),frame.getHeight(),QImage::Format_RGB888);
-                
-        /// Communicate the viewport to the GUI
-        compute_frame_bbox(frame); 
-        emit scene_bbox_updated(_bbox);        
-    }    
-           
-    /// Allow passing VideoFrameRefs
-    qRegisterMetaType<VideoFrameRef>("VideoFrameRef");///< Allow pass reference frame as signals
+        Frame empty;
+        empty.points.resize(width, height);
+        _frames.fill(empty);
+        
+        /// The viewport is communicated to the GUI with the first frames
+        scene_bounds.reset();
+    }
+    
+    is_open = true;
+    emit progress("Kinect: ready");
+    emit opened();
+    return true;
 }
 
-BBox3 KinectHelper::compute_frame_bbox(VideoFrameRef frame){
-    // qDebug() << "KinectThread::setBoundingBox(VideoFrameRef frame)";
-    
-    /// Get depth data from the frame just fetched
-    const openni::DepthPixel* pDepth = (const openni::DepthPixel*)frame.getData();
-    float wx,wy,wz;
-    BBox3 box; box.setNull();
-    for (int y = 0; y<frame.getHeight(); ++y){
-        for(int x = 0; x<frame.getWidth(); ++x){
-            DepthPixel d = *pDepth;
-            pDepth++;
-            CoordinateConverter::convertDepthToWorld(depth, x, y, d, &wx, &wy, &wz);
-            box.extend( Vector3(wx,wy,wz) );
+void KinectHelper::suspend(){
+    suspended.fetchAndStoreOrdered(1);
+    /// Drop what was waiting, a resumed mode starts from fresh frames
+    VideoFrameRef depthFrame, colorFrame;
+    _synchronizer.take(&depthFrame, &colorFrame);
+}
+
+void KinectHelper::resume(){
+    suspended.fetchAndStoreOrdered(0);
+    if(raw_source && !raw_playing && playback_mode!=PLAYBACK_STEP && raw_next<raw_source->count()){
+        raw_start = raw_next;
+        raw_clock.start();
+        raw_playing = true;
+        QMetaObject::invokeMethod(this, "play_raw", Qt::QueuedConnection);
+    }
+}
+
+void KinectHelper::update_scene_bbox(PointFrame& points){
+    /// Frames left to the GPU only have a depth range, bound their frustum
+    if(!points.unprojected()){
+        unsigned short closest = USHRT_MAX, farthest = 0;
+        const unsigned short* depth = points.depth();
+        for(int i=0; i<points.size(); i++){
+            if(!depth[i]) continue;
+            closest = std::min(closest, depth[i]);
+            farthest = std::max(farthest, depth[i]);
         }
+        float* bounds = points.bounds();
+        bounds[0] = -.5f * points.xzFactor() * farthest;
+        bounds[1] = -.5f * points.yzFactor() * farthest;
+        bounds[2] = closest;
+        bounds[3] = -bounds[0];
+        bounds[4] = -bounds[1];
+        bounds[5] = farthest;
+    }
+    
+    /// Into scene coordinates
+    Eigen::AlignedBox3f frame_box(points.boundsMin(), points.boundsMax());
+    Eigen::Matrix4f pose = extrinsic();
+    if(points.hasBounds() && !pose.isIdentity()){
+        Eigen::AlignedBox3f sensor_box = frame_box;
+        frame_box.setEmpty();
+        for(int c=0; c<8; c++)
+            frame_box.extend( (pose * sensor_box.corner(Eigen::AlignedBox3f::CornerType(c)).homogeneous()).head<3>() );
     }
-    this->_bbox = box;
+    if(!scene_bounds.update(frame_box.min(), frame_box.max())) return;
+    const Eigen::AlignedBox3f& box = scene_bounds.box();
+    BBox3 bbox(box.min().cast<double>(), box.max().cast<double>());
+    {
+        QMutexLocker locker(&bbox_mutex);
+        _bbox = bbox;
+    }
+    emit scene_bbox_updated(bbox);
 }
 
 void KinectHelper::start(){
-    connect(depthListener, SIGNAL(new_frame_available(VideoFrameRef)), this, SLOT(updateDepthFrame(VideoFrameRef)));
-    connect(colorListener, SIGNAL(new_frame_available(VideoFrameRef)), this, SLOT(updateColorFrame(VideoFrameRef)));
-    connect(depthListener, SIGNAL(new_frame_available(VideoFrameRef)), this, SLOT(consume()));
-    connect(colorListener, SIGNAL(new_frame_available(VideoFrameRef)), this, SLOT(consume()));
+    /// Dumps are played from the kinect thread
+    if(raw_source){
+        raw_start = raw_next;
+        raw_clock.start();
+        if(!raw_playing){
+            raw_playing = true;
+            QMetaObject::invokeMethod(this, "play_raw", Qt::QueuedConnection);
+        }
+        return;
+    }
+    
+    /// Frames go straight into the (bounded) synchronizer, a queued connection 
+    /// would hold on to every frame until the kinect thread gets to it
+    connect(depthListener, SIGNAL(new_frame_available(VideoFrameRef)), this, SLOT(updateDepthFrame(VideoFrameRef)), Qt::DirectConnection);
+    connect(colorListener, SIGNAL(new_frame_available(VideoFrameRef)), this, SLOT(updateColorFrame(VideoFrameRef)), Qt::DirectConnection);
 }
 
 void KinectHelper::destroy(){    
     qDebug() << "KinectThread::destroy()";
+    stopRecording();
+    
+    /// No new frames, and let the pool finish with the ones it has
+    suspended.fetchAndStoreOrdered(1);
+    if(device.isValid() && !raw_source){
+        depth.removeNewFrameListener(depthListener);
+        color.removeNewFrameListener(colorListener);
+    }
+    if(pool){
+        while(consume_requests.fetchAndAddOrdered(0))
+            QThread::yieldCurrentThread();
+    }
+    
+    /// Never opened, nothing to release
+    if(!is_open && !raw_source && !device.isValid()){
+        release_openni();
+        delete this;
+        return;
+    }
+    
+    /// Frames still queued in a pipeline keep the recording mapped, the
+    /// reader goes with the last of them
+    if(raw_source){
+        raw_source.clear();
+        delete this;
+        return;
+    }
     
-    depth.removeNewFrameListener(depthListener);
-    color.removeNewFrameListener(colorListener);
     depth.stop();
     color.stop();
     depth.destroy();
     color.destroy();
     device.close();
-    OpenNI::shutdown();
+    release_openni();
     
     /// Finally delete this object
     delete this;
@@ -103,19 +226,75 @@ void KinectHelper::destroy(){
 
 void KinectHelper::drawCloud(){
     // qDebug() << "KinectHelper::drawCloud()" << QThread::currentThreadId();
-    Q_ASSERT(!mutex()->tryLock());
-    if(!data_ready()) return;
+    FrameReader frame(_frames);
+    if(!frame.isValid()) return;
+    KinectProfiler::Scope scope(KinectProfiler::DRAW, sensor_id, frame->points.index());
     
-    /// The lock allows us to just use a reference to the buffer
-    PImage& data = (*points_front_buffer);        
-    glDisable(GL_LIGHTING);
+    /// The reader allows us to just use a reference to the buffer, which
+    /// is uploaded to the GPU only once per frame
+    /// Lit if there are normals
+    glPushAttrib(GL_ENABLE_BIT);
+    if(frame->points.hasNormals()){
+        glEnable(GL_LIGHTING);
+        glEnable(GL_COLOR_MATERIAL);
+    } else {
+        glDisable(GL_LIGHTING);
+    }
     glColor3d(1.0,0.0,0.0);
-    glBegin(GL_POINTS);
-    for(int c=0; c<data.cols(); c++)
-        for(int r=0; r<data.rows(); r++)
-            glVertex3dv( data(r,c).data() );    
-    glEnd();
-    glEnable(GL_LIGHTING);
+    glPushMatrix();
+    glMultMatrixf(extrinsic().data());
+    int stride = CloudRenderer::levelOfDetail(frame->points, max_stride);
+    if(frame->points.unprojected())
+        renderer.draw(frame->points, stride);
+    else
+        gpu_renderer.draw(frame->points, frame->color.view(), stride);
+    glPopMatrix();
+    glPopAttrib();
+}
+
+KinectHelper::PImage& KinectHelper::pointBuffer(){
+    Q_ASSERT(!mutex()->tryLock());
+    PointFrame& frame = pointFrame();
+    
+    /// Only convert once per frame
+    if(points_legacy.rows()!=frame.height() || points_legacy.cols()!=frame.width()){
+        points_legacy.resize(frame.height(), frame.width());
+        points_legacy_index = -1;
+    }
+    if(points_legacy_index == frame.index())
+        return points_legacy;
+    
+    /// Frames left to the GPU have no points yet, unproject them here into
+    /// a frame of our own (the published one is shared with the renderer),
+    /// with a table of our own too, the worker may be rebuilding its one
+    const PointFrame* points = &frame;
+    if(!frame.unprojected()){
+        if(!legacy_unprojector.matches(frame.width(), frame.height()) 
+           || legacy_unprojector.xzFactor()!=frame.xzFactor() || legacy_unprojector.yzFactor()!=frame.yzFactor())
+            legacy_unprojector.setupFactors(frame.width(), frame.height(), frame.xzFactor(), frame.yzFactor());
+        legacy_points.resize(frame.width(), frame.height());
+        legacy_unprojector.unproject(frame.depth(), legacy_points);
+        points = &legacy_points;
+    }
+    
+    for(int y=0; y<frame.height(); y++)
+        for(int x=0; x<frame.width(); x++)
+            points_legacy(y,x) = points->point(x,y).cast<double>();
+    points_legacy_index = frame.index();
+    return points_legacy;
+}
+
+QImage& KinectHelper::colorBuffer(){
+    Q_ASSERT(!mutex()->tryLock());
+    _frames.acquire();
+    const ColorFrame& frame = _frames.front().color;
+    
+    /// Only copy once per frame
+    if(color_legacy_index != frame.index()){
+        color_legacy = frame.image();
+        color_legacy_index = frame.index();
+    }
+    return color_legacy;
 }
 
 void KinectHelper::autoCreateWidgetsIfNecessary(){
@@ -132,134 +311,211 @@ void KinectHelper::autoCreateWidgetsIfNecessary(){
 }
 
 void KinectHelper::drawColor(QImage *image){
-    Q_ASSERT(!mutex()->tryLock());
     /// Don't bother drawing empty image
-    if(!data_ready())
+    FrameReader frame(_frames);
+    if(!frame.isValid())
         return;
      
     /// You didn't give me anything, I will instantiate it! 
     autoCreateWidgetsIfNecessary();
+    
+    /// The label only changes with the frame, not at every repaint
+    if(color_label_index == frame->color.index())
+        return;
+    color_label_index = frame->color.index();
         
     if(image==NULL)
-        colorLabel->setPixmap(QPixmap::fromImage(*color_front_buffer));     ///< Maybe this is not even necessary?
+        colorLabel->setPixmap(QPixmap::fromImage(frame->color.view()));
     else
-        colorLabel->setPixmap(QPixmap::fromImage(*image));     ///< Maybe this is not even necessary?
+        colorLabel->setPixmap(QPixmap::fromImage(*image));
 }
 
 void KinectHelper::updateDepthFrame(openni::VideoFrameRef frame){
+    /// The streams stay warm while suspended, but nothing is processed
+    if(suspended.fetchAndAddRelaxed(0)) return;
     /// Fetch new depth frame from the frame listener class
     DEBUG_QUEUE qDebug() << "queued depth frame#" << frame.getFrameIndex();
-    depthQueue.enqueue(frame);
+    KinectProfiler::instance().record(KinectProfiler::ARRIVAL, sensor_id, frame.getFrameIndex());
+    KinectProfiler::Scope scope(KinectProfiler::ENQUEUE, sensor_id, frame.getFrameIndex());
+    _synchronizer.pushDepth(frame);
+    requestConsume();
 }
 
 void KinectHelper::updateColorFrame(openni::VideoFrameRef frame){
+    if(suspended.fetchAndAddRelaxed(0)) return;
     DEBUG_QUEUE qDebug() << "queued color frame#" << frame.getFrameIndex();
-    colorQueue.enqueue(frame);
+    KinectProfiler::instance().record(KinectProfiler::ARRIVAL, sensor_id, frame.getFrameIndex());
+    KinectProfiler::Scope scope(KinectProfiler::ENQUEUE, sensor_id, frame.getFrameIndex());
+    _synchronizer.pushColor(frame);
+    requestConsume();
+}
+
+/// Runs the requested consume()s of a sensor in the shared pool
+class ConsumeTask : public QRunnable{
+public:
+    ConsumeTask(KinectHelper* helper) : helper(helper){}
+    void run(){ helper->consume_requested(); }
+private:
+    KinectHelper* helper;
+};
+
+void KinectHelper::requestConsume(){
+    /// The first request schedules a consume_requested(), which also serves
+    /// the ones arriving until it is done: frames of a sensor are never
+    /// processed concurrently, and at most one task waits in the pool
+    if(consume_requests.fetchAndAddOrdered(1) != 0) return;
+    if(pool)
+        pool->start(new ConsumeTask(this));
+    else
+        QMetaObject::invokeMethod(this, "consume_requested", Qt::QueuedConnection);
 }
 
-void KinectHelper::queuesStatus(){
-    int depthItem = depthQueue.empty() ? -1 : depthQueue.head().getFrameIndex();
-    int colorItem = colorQueue.empty() ? -1 : colorQueue.head().getFrameIndex();
-    qDebug() << "SIZE D#" << depthQueue.size() << "C#" << colorQueue.size();
-    qDebug() << "HEAD D#" << depthItem << "C#" << colorItem;
+void KinectHelper::consume_requested(){
+    int requests;
+    do{
+        requests = consume_requests.fetchAndAddOrdered(0);
+        consume();
+    } while(consume_requests.fetchAndAddOrdered(-requests) != requests);
 }
 
 void KinectHelper::consume(){
     // qDebug() << "KinectThread::consume()" << QThread::currentThreadId();
     
-    if(depthQueue.empty() || colorQueue.empty()) return;
-
-    DEBUG_QUEUE queuesStatus();
-       
-    while( (!depthQueue.empty()) && colorQueue.head().getFrameIndex()>depthQueue.head().getFrameIndex() ){
-        DEBUG_QUEUE qDebug() << "dQueue pop" << depthQueue.head().getFrameIndex();
-        depthQueue.dequeue();
+    /// Frames of a dump, scheduled by play_raw() or step()
+    if(raw_source){
+        int i = raw_due.fetchAndStoreOrdered(-1);
+        if(i<0) return;
+        deliver_raw(i);
+        /// The next frame is due once this one was delivered
+        if(playback_mode==PLAYBACK_FASTEST)
+            QMetaObject::invokeMethod(this, "play_raw", Qt::QueuedConnection);
+        return;
     }
     
-    if(depthQueue.empty() || colorQueue.empty()) return;
+    DEBUG_QUEUE _synchronizer.status();
+
+    /// Skip straight to the newest pair, older frames were dropped
+    VideoFrameRef depthFrame, colorFrame;
+    {
+        KinectProfiler::Scope scope(KinectProfiler::MATCH, sensor_id);
+        if(!_synchronizer.take(&depthFrame, &colorFrame)) return;
+        scope.setFrame(depthFrame.getFrameIndex());
+    }
     
-    while( (!colorQueue.empty()) && depthQueue.head().getFrameIndex()>colorQueue.head().getFrameIndex() ){
-        DEBUG_QUEUE qDebug() << "cQueue pop" << colorQueue.head().getFrameIndex();
-        colorQueue.dequeue();
+    /// Another video mode may come with another field of view, even at
+    /// the same resolution
+    VideoMode mode = depthFrame.getVideoMode();
+    if(mode.getResolutionX()!=depth_mode.getResolutionX() || mode.getResolutionY()!=depth_mode.getResolutionY()
+       || mode.getFps()!=depth_mode.getFps() || mode.getPixelFormat()!=depth_mode.getPixelFormat()){
+        depth_mode = mode;
+        depth_hfov = depth.getHorizontalFieldOfView();
+        depth_vfov = depth.getVerticalFieldOfView();
     }
-
-    if(depthQueue.empty() || colorQueue.empty()) return;
     
     DEBUG_QUEUE qDebug() << "CONSUMED";
-    DEBUG_QUEUE qDebug() << "depth frame#" << depthQueue.head().getFrameIndex();
-    DEBUG_QUEUE qDebug() << "color frame#" << colorQueue.head().getFrameIndex();
+    DEBUG_QUEUE qDebug() << "depth frame#" << depthFrame.getFrameIndex();
+    DEBUG_QUEUE qDebug() << "color frame#" << colorFrame.getFrameIndex();
 
     /// Finally consume
-    consume_depth( depthQueue.dequeue() );
-    consume_color( colorQueue.dequeue() );
-    has_consumed_first_frame = true;
-}
-
-void KinectHelper::consume_depth(VideoFrameRef frame){
-    /// Get depth data from the frame just fetched
-    const openni::DepthPixel* pDepth = (const openni::DepthPixel*)frame.getData();
-
-    float wx,wy,wz;
-    
-    /// NaN values must be handled well and not displayed by OpenGL
-    for (int y = 0; y<frame.getHeight(); ++y){
-        for(int x = 0; x<frame.getWidth(); ++x){
-            DepthPixel d = *pDepth;
-            pDepth++;
-            /// Convert depth coordinates to world coordinates to remove camera intrinsics
-            CoordinateConverter::convertDepthToWorld(depth, x, y, d, &wx, &wy, &wz);
-            /// Change the coordinates of the vertices in the model
-            (*points_back_buffer)(y,x) = Vector3(wx,wy,wz);
+    KinectProfiler::Scope consume_scope(KinectProfiler::CONSUME, sensor_id, depthFrame.getFrameIndex());
+    consume_depth( (const DepthPixel*) depthFrame.getData(), depthFrame.getWidth(), depthFrame.getHeight(), depthFrame.getFrameIndex() );
+    consume_color( colorFrame );
+    
+    /// Raw recordings store the pairs as they were consumed
+    {
+        ProfiledMutexLocker locker(&recording_mutex, sensor_id);
+        if(raw_recorder.isOpen()){
+            const ColorFrame& consumed = _frames.back().color;
+            raw_recorder.push(depthFrame.getTimestamp(), depthFrame.getFrameIndex(), 
+                              (const DepthPixel*) depthFrame.getData(), consumed.data(), consumed.bytesPerLine());
         }
     }
     
-    /// Now swap front and back buffers
-    _mutex.lock();
-        qSwap(points_front_buffer, points_back_buffer);
-    _mutex.unlock();    
+    /// Hand both to the GUI, this never waits for a reader
+    KinectProfiler::Scope scope(KinectProfiler::SWAP, sensor_id, depthFrame.getFrameIndex());
+    _frames.publish();
 }
 
-void KinectHelper::consume_color(VideoFrameRef frame){
-    /// Fetch new color frame from the frame listener class
+void KinectHelper::consume_depth(const DepthPixel* pDepth, int width, int height, int index){
+    KinectProfiler::Scope scope(KinectProfiler::UNPROJECT, sensor_id, index);
+    PointFrame& points = _frames.back().points;
+
+    /// The video mode or the field of view changed, rebuild the rays and the buffers
+    if(!unprojector.matches(width, height, depth_hfov, depth_vfov))
+        unprojector.setup(width, height, depth_hfov, depth_vfov);
+    if(points.width()!=width || points.height()!=height)
+        points.resize(width, height);
+    
+    /// Copy the raw depth only if it is needed as such: the GPU path 
+    /// unprojects from it, the filter works in place (recordings keep the raw
+    /// depth). Otherwise the points come straight from the sensor buffer, and
+    /// their z is the depth
+    bool keep_depth = gpu_unprojection || depth_filter.enabled();
+    if(keep_depth)
+        std::copy(pDepth, pDepth + width*height, points.depth());
+    points.setHasDepth(keep_depth);
+    points.setIntrinsics(unprojector.xzFactor(), unprojector.yzFactor());
+    points.setIndex(index);
+    points.setSensor(sensor_id);
+    
+    /// Optional denoising, on the copy
+    if(depth_filter.enabled()){
+        KinectProfiler::Scope scope(KinectProfiler::FILTER, sensor_id, index);
+        depth_filter.apply(points.depth(), width, height);
+    }
+    
+    /// Convert depth coordinates to world coordinates to remove camera intrinsics
+    /// (vectorized with the best instruction set of this CPU). Pixels without
+    /// depth are flagged in the validity mask, so they are not displayed
+    if(!gpu_unprojection)
+        unprojector.unproject(keep_depth ? points.depth() : pDepth, points);
+    points.setUnprojected(!gpu_unprojection);
+    
+    /// Normals for lighting and for the stages (needs the points)
+    if(estimate_normals && points.unprojected()){
+        KinectProfiler::Scope scope(KinectProfiler::NORMALS, sensor_id, index);
+        normal_estimator.estimate(points);
+    } else {
+        points.setHasNormals(false);
+    }
     
-    /// Get color data from the frame just fetched
-    const openni::RGB888Pixel* imageBuffer = (const openni::RGB888Pixel*) frame.getData();
-    /// Convert OpenCV mat to QImage
-    (*color_back_buffer) = QImage((uchar*) imageBuffer, frame.getWidth(), frame.getHeight(), QImage::Format_RGB888);
+    /// The kernels reduced the bounding box on the way
+    update_scene_bbox(points);
+}
 
-    _mutex.lock();
-        qSwap(color_front_buffer, color_back_buffer);
-    _mutex.unlock();
+void KinectHelper::consume_color(VideoFrameRef frame){
+    KinectProfiler::Scope scope(KinectProfiler::COLOR, sensor_id, frame.getFrameIndex());
+    /// Keep a reference to the OpenNI buffer, pixels are only copied if a 
+    /// client asks for a mutable image
+    _frames.back().color = ColorFrame(frame);
 }
 
 /// @todo exceptions instead of qDebug() 
-int KinectHelper::initialize_device(){
+int KinectHelper::initialize_device(QString uri){
 
     rc = STATUS_OK;
 
-    /// Fetch the device URI to pass to Device::open()
-    const char* deviceURI = ANY_DEVICE;
+    /// Fetch the device URI to pass to Device::open() (.oni files open a file device)
+    QByteArray uriBytes = uri.toLocal8Bit();
+    const char* deviceURI = uri.isEmpty() ? ANY_DEVICE : uriBytes.constData();
 
     /// Initialize the device
-    rc = OpenNI::initialize();
-    if(rc!=openni::STATUS_OK)
-    {
-        qDebug()<<"Initialization Errors (if any): "<<OpenNI::getExtendedError();
-        OpenNI::shutdown();
+    emit progress("Kinect: initializing OpenNI");
+    if(!acquire_openni())
         return false;
-    }
 
 
     /// Open the device using the previously fetched device URI
+    emit progress(uri.isEmpty() ? QString("Kinect: opening the device") : "Kinect: opening " + uri);
     rc = device.open(deviceURI);
     if (rc != openni::STATUS_OK)
     {
         qDebug()<<"Device open failed: "<<openni::OpenNI::getExtendedError();
-        OpenNI::shutdown();
-        return false;
+        return abort_device();
     }
 
     /// Create the depth stream
+    emit progress("Kinect: starting the depth stream");
     rc = depth.create(device, openni::SENSOR_DEPTH);
 
     if (rc == openni::STATUS_OK)
@@ -270,24 +526,23 @@ int KinectHelper::initialize_device(){
         if (rc != openni::STATUS_OK)
         {
             qDebug()<<"Couldn't start depth stream: "<<openni::OpenNI::getExtendedError();
-            depth.destroy();
-            return false;
+            return abort_device();
         }
     }
     else
     {
         qDebug()<<"Couldn't find depth stream: "<<openni::OpenNI::getExtendedError();
-        return false;
+        return abort_device();
     }
 
     if (!depth.isValid())
     {
         qDebug()<<"No valid depth streams. Exiting";
-        OpenNI::shutdown();
-        return false;
+        return abort_device();
     }
 
     /// Create the color stream
+    emit progress("Kinect: starting the color stream");
     rc = color.create(device, openni::SENSOR_COLOR);
 
     if (rc == openni::STATUS_OK)
@@ -298,21 +553,26 @@ int KinectHelper::initialize_device(){
         if (rc != openni::STATUS_OK)
         {
             qDebug()<<"Couldn't start color stream: "<<openni::OpenNI::getExtendedError();
-            color.destroy();
-            return false;
+            return abort_device();
         }
     }
     else
     {
         qDebug()<<"Couldn't find color stream: "<<openni::OpenNI::getExtendedError();
-        return false;
+        return abort_device();
     }
 
     if (!color.isValid())
     {
         qDebug()<<"No valid color streams. Exiting";
-        OpenNI::shutdown();
-        return false;
+        return abort_device();
+    }
+
+    /// Recordings are synchronized and registered already
+    if(device.isFile()){
+        device.getPlaybackControl()->setRepeatEnabled(false);
+        setPlaybackMode(playback_mode);
+        return true;
     }
 
 #define SYNCRO
@@ -322,8 +582,7 @@ int KinectHelper::initialize_device(){
     if (rc != openni::STATUS_OK)
     {
         qDebug()<<"Could not synchronise device";
-        OpenNI::shutdown();
-        return false;
+        return abort_device();
     }
 #endif
 
@@ -332,9 +591,292 @@ int KinectHelper::initialize_device(){
     if (rc != openni::STATUS_OK)
     {
         qDebug()<<"Could not set Image Registration Mode";
-        OpenNI::shutdown();
+        return abort_device();
+    }
+
+    return true;
+}
+
+/// Every failure of initialize_device() after OpenNI was acquired goes
+/// through here, so that nothing is left open
+bool KinectHelper::abort_device(){
+    depth.stop();
+    color.stop();
+    depth.destroy();
+    color.destroy();
+    device.close();
+    release_openni();
+    return false;
+}
+
+bool KinectHelper::initialize_raw(QString uri){
+    raw_source = QSharedPointer<RawFrameReader>(new RawFrameReader());
+    if(!raw_source->open(uri) || raw_source->count()==0){
+        qDebug()<<"Could not play raw recording"<<uri;
+        raw_source.clear();
         return false;
     }
+    return true;
+}
+
+/// Speeds of openni::PlaybackControl::setSpeed with a special meaning
+static const float ONI_SPEED_FASTEST = 0.0f;
+static const float ONI_SPEED_MANUAL = -1.0f;
+
+void KinectHelper::setPlaybackMode(int mode){
+    playback_mode = PlaybackMode(mode);
+    if(is_oni()){
+        float speed = 1.0f;
+        if(playback_mode==PLAYBACK_FASTEST) speed = ONI_SPEED_FASTEST;
+        if(playback_mode==PLAYBACK_STEP) speed = ONI_SPEED_MANUAL;
+        device.getPlaybackControl()->setSpeed(speed);
+    }
+    /// Restart the clock of real-time playback from the current frame
+    raw_start = raw_next;
+    raw_clock.start();
+    
+    /// Leaving step mode resumes the playback of dumps
+    if(raw_source && !raw_playing && playback_mode!=PLAYBACK_STEP && raw_next<raw_source->count()){
+        raw_playing = true;
+        QMetaObject::invokeMethod(this, "play_raw", Qt::QueuedConnection);
+    }
+}
+
+void KinectHelper::step(){
+    if(raw_source){
+        if(raw_next < raw_source->count()) schedule_raw(raw_next++);
+        else emit end_of_recording();
+        return;
+    }
+    if(!is_oni()) return;
+    
+    /// In manual mode OpenNI produces a frame per readFrame
+    VideoFrameRef depthFrame, colorFrame;
+    if(depth.readFrame(&depthFrame)==STATUS_OK) updateDepthFrame(depthFrame);
+    if(color.readFrame(&colorFrame)==STATUS_OK) updateColorFrame(colorFrame);
+}
+
+void KinectHelper::play_raw(){
+    raw_playing = false;
+    if(!raw_source || playback_mode==PLAYBACK_STEP || suspended.fetchAndAddRelaxed(0)) return;
+    if(raw_next >= raw_source->count()){
+        emit end_of_recording();
+        return;
+    }
+    schedule_raw(raw_next++);
+    if(raw_next >= raw_source->count()){
+        emit end_of_recording();
+        return;
+    }
+    
+    /// Go through the event loop between frames, so that slots still run
+    raw_playing = true;
+    if(playback_mode==PLAYBACK_FASTEST){
+        /// With a pool, consume() asks for the next frame once this one is done
+        if(!pool) QMetaObject::invokeMethod(this, "play_raw", Qt::QueuedConnection);
+    } else {
+        qint64 due = qint64(raw_source->timestamp(raw_next) - raw_source->timestamp(raw_start)) / 1000;
+        QTimer::singleShot(qMax<qint64>(0, due - raw_clock.elapsed()), this, SLOT(play_raw()));
+    }
+}
+
+void KinectHelper::schedule_raw(int i){
+    if(!pool){
+        deliver_raw(i);
+        return;
+    }
+    raw_due.fetchAndStoreOrdered(i);
+    requestConsume();
+}
+
+void KinectHelper::deliver_raw(int i){
+    const RawFrameFile::Header& header = raw_source->header();
+    KinectProfiler::instance().record(KinectProfiler::ARRIVAL, sensor_id, raw_source->index(i));
+    KinectProfiler::Scope consume_scope(KinectProfiler::CONSUME, sensor_id, raw_source->index(i));
+    consume_depth(raw_source->depth(i), header.width, header.height, raw_source->index(i));
+    {
+        /// The pixels stay in the mapped file, which the frame keeps open
+        KinectProfiler::Scope scope(KinectProfiler::COLOR, sensor_id, raw_source->index(i));
+        _frames.back().color = ColorFrame(raw_source, i);
+    }
+    
+    {
+        ProfiledMutexLocker locker(&recording_mutex, sensor_id);
+        if(raw_recorder.isOpen())
+            raw_recorder.push(raw_source->timestamp(i), raw_source->index(i), raw_source->depth(i), raw_source->color(i));
+    }
+    
+    KinectProfiler::Scope scope(KinectProfiler::SWAP, sensor_id, raw_source->index(i));
+    _frames.publish();
+}
+
+void KinectHelper::seek(int frame){
+    if(!raw_source) return;
+    raw_next = qBound(0, frame, raw_source->count()-1);
+    /// Restarts the clock, and the playback if it had reached the end
+    setPlaybackMode(playback_mode);
+}
+
+bool KinectHelper::startRecording(QString path, bool compress){
+    stopRecording();
+    QMutexLocker locker(&recording_mutex);
+    
+    /// OpenNI records the streams themselves
+    if(path.endsWith(".oni", Qt::CaseInsensitive)){
+        if(raw_source){
+            qDebug()<<"Raw recordings can only be recorded to .kraw";
+            return false;
+        }
+        if(oni_recorder.create(path.toLocal8Bit().constData())!=STATUS_OK
+           || oni_recorder.attach(depth)!=STATUS_OK
+           || oni_recorder.attach(color)!=STATUS_OK
+           || oni_recorder.start()!=STATUS_OK){
+            qDebug()<<"Could not record"<<path<<openni::OpenNI::getExtendedError();
+            oni_recorder.destroy();
+            return false;
+        }
+        return true;
+    }
+    
+    /// Everything else gets the consumed pairs
+    int colorWidth, colorHeight;
+    if(raw_source){
+        colorWidth = raw_source->header().colorWidth;
+        colorHeight = raw_source->header().colorHeight;
+    } else {
+        VideoMode mode = color.getVideoMode();
+        colorWidth = mode.getResolutionX();
+        colorHeight = mode.getResolutionY();
+    }
+    return raw_recorder.open(path, unprojector.width(), unprojector.height(), 
+                             colorWidth, colorHeight, depth_hfov, depth_vfov,
+                             compress ? RawFrameFile::DEPTH_DELTA : RawFrameFile::DEPTH_RAW);
+}
+
+void KinectHelper::stopRecording(){
+    QMutexLocker locker(&recording_mutex);
+    if(oni_recorder.isValid()){
+        oni_recorder.stop();
+        oni_recorder.destroy();
+    }
+    raw_recorder.close();
+}
 
+/// @{ one initialization of OpenNI for all the helpers
+static QMutex openni_mutex;
+static int openni_users = 0;
+static bool openni_acquire(){
+    QMutexLocker locker(&openni_mutex);
+    if(openni_users==0 && OpenNI::initialize()!=openni::STATUS_OK){
+        qDebug()<<"Initialization Errors (if any): "<<OpenNI::getExtendedError();
+        OpenNI::shutdown();
+        return false;
+    }
+    openni_users++;
     return true;
 }
+static void openni_release(){
+    QMutexLocker locker(&openni_mutex);
+    if(--openni_users==0)
+        OpenNI::shutdown();
+}
+/// @}
+
+bool KinectHelper::acquire_openni(){
+    if(!openni_acquired)
+        openni_acquired = openni_acquire();
+    return openni_acquired;
+}
+
+void KinectHelper::release_openni(){
+    if(openni_acquired)
+        openni_release();
+    openni_acquired = false;
+}
+
+QStringList KinectHelper::connectedDevices(){
+    QStringList uris;
+    if(!openni_acquire()) return uris;
+    Array<DeviceInfo> devices;
+    OpenNI::enumerateDevices(&devices);
+    for(int i=0; i<devices.getSize(); i++)
+        uris << devices[i].getUri();
+    openni_release();
+    return uris;
+}
+
+void KinectHelper::setExtrinsic(const Eigen::Matrix4f& pose){
+    QMutexLocker locker(&bbox_mutex);
+    _extrinsic = pose;
+}
+
+Eigen::Matrix4f KinectHelper::extrinsic(){
+    QMutexLocker locker(&bbox_mutex);
+    return _extrinsic;
+}
+
+QVariantMap KinectHelper::statistics() const{
+    QVariantMap stats = KinectProfiler::instance().statistics(sensor_id);
+    stats["matched"] = _synchronizer.matched();
+    stats["dropped_depth"] = _synchronizer.droppedDepth();
+    stats["dropped_color"] = _synchronizer.droppedColor();
+    stats["queued_depth"] = _synchronizer.queuedDepth();
+    stats["queued_color"] = _synchronizer.queuedColor();
+    stats["recorded"] = raw_recorder.written();
+    stats["recording_dropped"] = raw_recorder.dropped();
+    return stats;
+}
+
+KinectStatistics::KinectStatistics(const QList<KinectHelper*>& sensors, FramePipeline* pipeline, QObject* parent) : 
+    QObject(parent), sensors(sensors), pipeline(pipeline){
+    setObjectName("kinect_statistics");
+}
+
+QVariantMap KinectStatistics::statistics(){
+    if(sensors.isEmpty()) return QVariantMap();
+    QVariantMap stats = sensors.first()->statistics();
+    if(pipeline){
+        stats["pipeline_completed"] = pipeline->completed();
+        stats["pipeline_dropped"] = pipeline->dropped();
+    }
+    for(int i=1; i<sensors.size(); i++)
+        stats[QString("sensor%1").arg(i)] = sensors[i]->statistics();
+    return stats;
+}
+
+QString KinectStatistics::report(){
+    QVariantMap s = statistics();
+    if(s.isEmpty()) return QString();
+    QString text;
+    text += QString("%1 fps, latency %2 ms (p99 %3)\n")
+            .arg(s["swap_per_second"].toDouble(), 0, 'f', 1)
+            .arg(s["latency_mean_ms"].toDouble(), 0, 'f', 1)
+            .arg(s["latency_p99_ms"].toDouble(), 0, 'f', 1);
+    const char* stages[] = {"enqueue", "match", "filter", "unproject", "normals", "color", "swap", "consume", "work", "draw", "lock_wait"};
+    for(int i=0; i<11; i++)
+        text += QString("%1: %2 us (p99 %3)\n").arg(stages[i])
+                .arg(s[QString(stages[i])+"_mean_us"].toDouble(), 0, 'f', 1)
+                .arg(s[QString(stages[i])+"_p99_us"].toDouble(), 0, 'f', 1);
+    text += QString("queued D#%1 C#%2, dropped D#%3 C#%4")
+            .arg(s["queued_depth"].toInt()).arg(s["queued_color"].toInt())
+            .arg(s["dropped_depth"].toInt()).arg(s["dropped_color"].toInt());
+    if(pipeline)
+        text += QString(", pipeline dropped %1").arg(s["pipeline_dropped"].toInt());
+    if(s["recorded"].toInt() || s["recording_dropped"].toInt())
+        text += QString("\nrecorded %1, dropped %2").arg(s["recorded"].toInt()).arg(s["recording_dropped"].toInt());
+    /// The other sensors in short
+    for(int i=1; i<sensors.size(); i++){
+        QVariantMap o = s[QString("sensor%1").arg(i)].toMap();
+        text += QString("\nsensor %1: %2 fps, latency %3 ms (p99 %4), unproject %5 us")
+                .arg(i)
+                .arg(o["swap_per_second"].toDouble(), 0, 'f', 1)
+                .arg(o["latency_mean_ms"].toDouble(), 0, 'f', 1)
+                .arg(o["latency_p99_ms"].toDouble(), 0, 'f', 1)
+                .arg(o["unproject_mean_us"].toDouble(), 0, 'f', 1);
+    }
+    return text;
+}
+
+void KinectStatistics::refresh(){
+    emit reportChanged(report());
+}
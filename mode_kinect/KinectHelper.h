@@ -1,12 +1,25 @@
 #pragma once
 #include <QThread>
+#include <QThreadPool>
 #include <QtConcurrentRun>
 #include <QDebug>
 #include <QtOpenGL>
-#include <QQueue>
+#include <QElapsedTimer>
 
 #include "Starlab.h"
 #include "OpenNI.h"
+#include "DepthUnprojector.h"
+#include "DepthFilter.h"
+#include "NormalEstimator.h"
+#include "KinectFrame.h"
+#include "CloudRenderer.h"
+#include "GpuCloudRenderer.h"
+#include "TripleBuffer.h"
+#include "FrameSynchronizer.h"
+#include "RawFrameFile.h"
+#include "FrameRecorder.h"
+#include "KinectProfiler.h"
+#include "SceneBounds.h"
 
 using namespace openni;
 using namespace Starlab;
@@ -14,95 +27,267 @@ using namespace Starlab;
 /// FD
 class ModeKinectListener;
 class KinectWidget;
+class FramePipeline;
 
 class KinectHelper : public QObject{
     Q_OBJECT
+    friend class KinectBenchmark; ///< drives the stages one by one
     
 /// @{ data
 public:
     typedef Starlab::BBox3 BBox3;
     typedef Eigen::Vector3d Point;
-    typedef Eigen::Matrix<Point, Eigen::Dynamic, Eigen::Dynamic> PImage; ///< an image of Points    
-private:
-    typedef QQueue<VideoFrameRef> DepthQueue;
-    typedef QQueue<VideoFrameRef> ColorQueue;
-    
+    typedef Eigen::Matrix<Point, Eigen::Dynamic, Eigen::Dynamic> PImage; ///< an image of Points (legacy)
+    typedef KinectFrame Frame;
+    typedef TripleBuffer<Frame> FrameBuffer;
+    /// Stable snapshot of the latest frame, never blocks the kinect thread
+    /// @note use from the GUI thread only
+    typedef FrameBuffer::Reader FrameReader;
 private:
     BBox3 _bbox;
+    QMutex bbox_mutex;       ///< _bbox is written by the thread consuming the frames
+    SceneBounds scene_bounds; ///< filters the boxes of the frames (kinect thread)
 public:
-    BBox3 bbox(){ return _bbox; }
+    /// Bounding box of the scene (see setExtrinsic), null until a frame with depth arrived
+    BBox3 bbox(){ QMutexLocker locker(&bbox_mutex); return _bbox; }
+    /// Only serializes legacy clients, the kinect thread never takes it
     QMutex* mutex(){ return &_mutex; }
+    /// Frames exchanged with the kinect thread, read them through a FrameReader
+    FrameBuffer& frames(){ return _frames; }
 private:
     QTimer* timer;
     QMutex _mutex;
-    PImage* points_front_buffer; ///< &cloud_buffer_1
-    PImage* points_back_buffer;  ///< &cloud_buffer_2  
-    PImage points_buffer_1;
-    PImage points_buffer_2;
-    
-    QImage* color_front_buffer; ///< &color_buffer_1
-    QImage* color_back_buffer;  ///< &color_buffer_2
-    QImage color_buffer_1;
-    QImage color_buffer_2;
+    FrameBuffer _frames;
+    PImage points_legacy; ///< front buffer converted for pointBuffer()
+    int points_legacy_index;   ///< frame index of points_legacy
+    DepthUnprojector legacy_unprojector; ///< rays for pointBuffer() of raw depth frames
+    PointFrame legacy_points;  ///< raw depth frames unprojected by pointBuffer()
+    QImage color_legacy;  ///< front buffer copied for colorBuffer()
+    int color_legacy_index;    ///< frame index of color_legacy
+    int color_label_index;     ///< frame index shown by colorLabel
 public:
+    /// @{ legacy accessors, each call may move on to a newer frame (use a
+    /// FrameReader to see the color and the points of the same frame)
     /// Lock mutex before accessing this resource!!
-    QImage& colorBuffer(){ return *color_front_buffer; }
+    /// @note mutable copy of the color, made once per frame
+    QImage& colorBuffer();
     /// Lock mutex before accessing this resource!!
-    PImage& pointBuffer(){ return *points_front_buffer; }
+    PointFrame& pointFrame(){ _frames.acquire(); return _frames.front().points; }
+    /// Lock mutex before accessing this resource!!
+    /// @note compatibility view, converts pointFrame() to doubles once per frame
+    PImage& pointBuffer();
+    /// @}
     
 private:
     Status rc;
     Device device;
     VideoStream depth, color;
+    float depth_hfov, depth_vfov; ///< field of view of the depth camera
+    VideoMode depth_mode;         ///< video mode depth_hfov and depth_vfov were read for
+    DepthUnprojector unprojector; ///< per-pixel rays of the depth stream
     ModeKinectListener* depthListener;
     ModeKinectListener* colorListener;
 /// @}
     
-/// @{
-    bool has_consumed_first_frame; ///< false
-    bool data_ready(){ return has_consumed_first_frame; }
+///
+/// @{ where depth is unprojected
+public:
+    /// Leave unprojection to the vertex shader of drawCloud(): the worker only
+    /// copies the raw depth, and pointFrame() has no points (see PointFrame::unprojected)
+    /// @note call before start()
+    void setGpuUnprojection(bool enabled){ gpu_unprojection = enabled; }
+    bool gpuUnprojection() const { return gpu_unprojection; }
+private:
+    bool gpu_unprojection; ///< false
 /// @} 
+
+/// @{ depth denoising, before unprojection
+public:
+    /// Off by default, its parameters may be changed from any thread
+    DepthFilter& depthFilter(){ return depth_filter; }
+private:
+    DepthFilter depth_filter;
+/// @}
+
+/// @{ normals, after unprojection
+public:
+    /// Estimate the normals of the points (see PointFrame::normals), which
+    /// also lights them in drawCloud(). Not with GPU unprojection.
+    /// @note call before start()
+    void setNormalEstimation(bool enabled){ estimate_normals = enabled; }
+    bool normalEstimation() const { return estimate_normals; }
+    NormalEstimator& normalEstimator(){ return normal_estimator; }
+private:
+    bool estimate_normals; ///< false
+    NormalEstimator normal_estimator;
+/// @}
 ///    
 /// @{ constructor/destructor    
 public:
-    KinectHelper(QObject* parent=0);
-    void start();    
+    /// uri: empty for the first sensor found, the path of an .oni recording
+    /// (played through OpenNI) or of a .kraw dump (see RawFrameFile)
+    /// @note cheap, the device is opened by open()
+    KinectHelper(QObject* parent=0, QString uri=QString());
+    bool isOpen() const { return is_open; }
 private:
     /// Use destroy()!
     ~KinectHelper(){}
 public slots: 
+    /// Opens the device, starts the streams and sizes the buffers from the first
+    /// frame. This takes seconds: invoke it once the helper lives in its thread, 
+    /// then follow progress(), failed() and opened()
+    bool open();
+    /// Starts consuming frames (call once opened)
+    void start();
+    /// Stops processing but keeps the device and its streams running, so that
+    /// resume() takes milliseconds instead of a new initialization
+    void suspend();
+    void resume();
     void destroy();
+signals:
+    /// Human readable description of the current initialization step
+    void progress(QString message);
+    void failed(QString message);
+    void opened();
 private:
-    int initialize_device();
+    QString uri;
+    bool is_open;         ///< set once open() succeeded
+    QAtomicInt suspended; ///< frames are dropped on arrival
+    int initialize_device(QString uri);
+    /// Stops the streams, closes the device and releases OpenNI, returns false
+    bool abort_device();
+    bool initialize_raw(QString uri);
 /// @}
     
 /// @{
 public slots:
-    /// called whenever a new depth frame is received. This function moves the 
-    /// vertices and modifies the mesh
+    /// called (in the OpenNI thread) whenever a new depth frame is received, 
+    /// hands it to the synchronizer
     void updateDepthFrame(VideoFrameRef frame);
-    /// called whenever a new color frame is received. It converts the color frame 
-    /// into a QImage which is passed to the main (GUI) thread through a signal
+    /// called (in the OpenNI thread) whenever a new color frame is received, 
+    /// hands it to the synchronizer
     void updateColorFrame(VideoFrameRef frame);
 public slots:
-    /// slot to consume the queue elements
+    /// slot to consume the newest matched depth/color pair (or the frame of
+    /// the dump that is due)
     void consume();
+public:
+    /// Pairs depth and color, keeps at most a couple of frames per stream
+    FrameSynchronizer& synchronizer(){ return _synchronizer; }
+    /// Timings of the stages of this sensor (see KinectProfiler) and counters of the synchronizer
+    /// @note safe to call from any thread
+    QVariantMap statistics() const;
 private:    
-    void queuesStatus(); ///< debugging helper
-    DepthQueue   depthQueue;
-    ColorQueue   colorQueue;
-    void consume_depth(VideoFrameRef frame);
+    FrameSynchronizer _synchronizer;
+    QAtomicInt consume_requests; ///< since the running consume_requested() started, 0 if none
+    QAtomicInt raw_due;          ///< frame of the dump for consume() to deliver, -1 if none
+    /// Schedules consume_requested(), unless it is scheduled or running already
+    void requestConsume();
+    friend class ConsumeTask;
+private slots:
+    /// Consumes until no more requests came in meanwhile
+    void consume_requested();
+private:
+    void consume_depth(const DepthPixel* depth, int width, int height, int index);
     void consume_color(VideoFrameRef frame);
 /// @}
     
+/// @{ recordings
+public:
+    enum PlaybackMode{ 
+        PLAYBACK_FASTEST,  ///< as fast as the frames can be consumed
+        PLAYBACK_REALTIME, ///< at the pace they were recorded
+        PLAYBACK_STEP      ///< one frame per call to step()
+    };
+    /// Does the data come from a recording rather than from a sensor?
+    bool isPlayback() const { return !raw_source.isNull() || is_oni(); }
+    PlaybackMode playbackMode() const { return playback_mode; }
+/// @note slots run in the kinect thread, invoke them through a signal or
+/// QMetaObject::invokeMethod once the helper has been moved there
+public slots:
+    /// @note a .kraw dump plays every frame exactly once, in PLAYBACK_FASTEST and
+    /// PLAYBACK_STEP modes the sequence of frames is deterministic
+    void setPlaybackMode(int mode);
+    /// Delivers the next frame of the recording (PLAYBACK_STEP)
+    void step();
+    /// Records the synchronized frames, to an .oni file through OpenNI or to a 
+    /// raw .kraw dump of the consumed pairs (any other extension). Dumps are
+    /// written by a thread of their own, with compressed depth unless "compress"
+    /// is false; frames are dropped if the disk can't keep up, see statistics()
+    bool startRecording(QString path, bool compress=true);
+    void stopRecording();
+    /// Moves the playback of a .kraw dump to a frame, delivered next
+    void seek(int frame);
+signals:
+    /// The last frame of a .kraw dump was delivered
+    void end_of_recording();
+private slots:
+    /// Delivers the next frame of the dump and schedules the following one
+    void play_raw();
+private:
+    void deliver_raw(int i);
+    /// Delivers frame i from the thread pool if there is one, right away if not
+    void schedule_raw(int i);
+    /// Playing an .oni file through OpenNI?
+    bool is_oni() const { return !raw_source && device.isValid() && device.isFile(); }
+    /// NULL unless playing a .kraw dump, shared with the ColorFrames that
+    /// point into its mapping
+    QSharedPointer<RawFrameReader> raw_source;
+    int raw_next;               ///< next frame of raw_source
+    QElapsedTimer raw_clock;    ///< time since raw_start
+    int raw_start;              ///< frame at which the clock was started
+    bool raw_playing;           ///< a play_raw() is scheduled
+    PlaybackMode playback_mode; ///< PLAYBACK_REALTIME
+    QMutex recording_mutex;     ///< guards the recorders
+    Recorder oni_recorder;
+    FrameRecorder raw_recorder;
+/// @}
+
+/// @{ several sensors
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    /// URIs of the sensors plugged in, one KinectHelper can open each of them
+    /// @note initializes OpenNI, which takes a moment
+    static QStringList connectedDevices();
+    /// Processes the frames in a pool shared with other sensors rather than in
+    /// the thread of the helper, which then only schedules them. Frames of one
+    /// sensor are still processed one at a time and in order.
+    /// @note call before start()
+    void setThreadPool(QThreadPool* pool){ this->pool = pool; }
+    /// Pose of the sensor in the scene (sensor to scene coordinates), applied
+    /// by drawCloud() and to bbox(). The frames stay in sensor coordinates.
+    /// @note safe to call from any thread
+    void setExtrinsic(const Eigen::Matrix4f& pose);
+    Eigen::Matrix4f extrinsic();
+    /// Unique in the process, tags the frames and the KinectProfiler events of the helper
+    int sensorId() const { return sensor_id; }
+private:
+    int sensor_id;
+    QThreadPool* pool;          ///< NULL: frames are processed in the thread of the helper
+    Eigen::Matrix4f _extrinsic; ///< identity, guarded by bbox_mutex
+    bool openni_acquired;       ///< this helper holds a reference on OpenNI
+    /// @{ OpenNI is initialized once for all the helpers of the process
+    bool acquire_openni();
+    void release_openni();
+    /// @}
+/// @}
+
 /// @{ hooks to be used in client application
 private:
-    BBox3 compute_frame_bbox(VideoFrameRef frame);    
+    /// Follows the box of the frame, emits scene_bbox_updated() if it moved
+    void update_scene_bbox(PointFrame& points);
+    CloudRenderer renderer; ///< GPU copy of the front buffer
+    GpuCloudRenderer gpu_renderer; ///< used instead of renderer for raw depth frames
+    int max_stride; ///< 8
+public:
+    /// Coarsest level of detail of drawCloud() (a power of two, 1 draws every pixel)
+    void setMaxStride(int stride){ max_stride = qMax(1, stride); }
 public slots:    
-    /// Draws the point cloud in OpenGL
+    /// Draws the point cloud in OpenGL, skipping the pixels that would fall
+    /// onto the same screen pixel (see CloudRenderer::levelOfDetail)
     void drawCloud();
 signals:
-    /// Updates the bounding box
+    /// The bounding box of the scene changed noticeably (see SceneBounds)
     void scene_bbox_updated(BBox3 box);
 /// @}
 
@@ -139,3 +324,25 @@ signals:
     void new_frame_available(VideoFrameRef);
 };
 
+/// Statistics of the acquisition for the GUI and for the Python console, where
+/// it can be found by its name: findChild(QObject, "kinect_statistics")
+class KinectStatistics : public QObject{
+    Q_OBJECT
+public:
+    /// The first sensor is the primary one, the pipeline processes its frames
+    KinectStatistics(const QList<KinectHelper*>& sensors, FramePipeline* pipeline=NULL, QObject* parent=0);
+public slots:
+    /// KinectHelper::statistics() of the primary sensor and the counters of
+    /// the pipeline, the statistics of sensor i>0 under "sensor<i>" (empty
+    /// without sensors)
+    QVariantMap statistics();
+    /// statistics() as a few lines of text
+    QString report();
+    /// Emits reportChanged, connect it to a timer
+    void refresh();
+signals:
+    void reportChanged(QString report);
+private:
+    QList<KinectHelper*> sensors;
+    FramePipeline* pipeline;
+};
@@ -0,0 +1,115 @@
+#include "KinectProfiler.h"
+#include <QHash>
+#include <algorithm>
+#include <vector>
+
+const char* KinectProfiler::name(Event event){
+    static const char* names[EVENT_COUNT] = {
+        "arrival", "enqueue", "match", "filter", "unproject", "normals", "color", "swap", "consume", "work", "draw", "lock_wait" };
+    return names[event];
+}
+
+KinectProfiler& KinectProfiler::instance(){
+    static KinectProfiler profiler;
+    return profiler;
+}
+
+KinectProfiler::Ring* KinectProfiler::ring(){
+    if(!_local.hasLocalData()){
+        RingRef* ref = new RingRef();
+        {
+            /// The records left by the previous owner are still valid events
+            QMutexLocker locker(&_rings_mutex);
+            if(!_free.isEmpty()){
+                ref->ring = _free.takeLast();
+            } else {
+                ref->ring = new Ring();
+                _rings.push_back(ref->ring);
+            }
+        }
+        _local.setLocalData(ref);
+    }
+    return _local.localData()->ring;
+}
+
+void KinectProfiler::release(Ring* ring){
+    QMutexLocker locker(&_rings_mutex);
+    _free.push_back(ring);
+}
+
+void KinectProfiler::record(Event event, int sensor, int frame, qint64 start, qint64 end){
+    Ring* r = ring();
+    Record& record = r->records[r->head & (RING_SIZE-1)];
+    /// Readers skip the record while the sequence number is odd
+    int sequence = record.sequence.fetchAndAddRelaxed(0);
+    record.sequence.fetchAndStoreRelease(sequence+1);
+    record.event = event;
+    record.sensor = sensor;
+    record.frame = frame;
+    record.start = start;
+    record.end = end;
+    record.sequence.fetchAndStoreRelease(sequence+2);
+    r->head++;
+}
+
+static double percentile(std::vector<double>& values, double p){
+    if(values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size()-1, size_t(p*values.size()))];
+}
+
+QVariantMap KinectProfiler::statistics(int sensor, qint64 window) const{
+    qint64 since = now() - window;
+    std::vector<double> durations[EVENT_COUNT]; ///< microseconds
+    QHash<int,qint64> arrivals;                 ///< frame -> first arrival
+    QHash<int,qint64> draws;                    ///< frame -> first draw done
+
+    /// Copy out the records that are not being overwritten
+    QList<Ring*> rings;
+    { QMutexLocker locker(&_rings_mutex); rings = _rings; }
+    foreach(Ring* ring, rings){
+        for(int i=0; i<RING_SIZE; i++){
+            Record& record = ring->records[i];
+            int before = record.sequence.fetchAndAddAcquire(0);
+            if(before==0 || (before & 1)) continue;
+            int event = record.event, frame = record.frame;
+            qint64 start = record.start, end = record.end;
+            bool other = record.sensor != sensor;
+            if(record.sequence.fetchAndAddAcquire(0) != before) continue;
+            /// Frame indices are only unique within a sensor
+            if(other || start < since || event<0 || event>=EVENT_COUNT) continue;
+
+            durations[event].push_back((end-start) / 1000.0);
+            if(frame<0) continue;
+            if(event==ARRIVAL && (!arrivals.contains(frame) || start<arrivals[frame]))
+                arrivals[frame] = start;
+            if(event==DRAW && (!draws.contains(frame) || end<draws[frame]))
+                draws[frame] = end;
+        }
+    }
+
+    QVariantMap stats;
+    double seconds = window / 1e9;
+    for(int e=0; e<EVENT_COUNT; e++){
+        std::vector<double>& values = durations[e];
+        double sum = 0;
+        for(size_t i=0; i<values.size(); i++) sum += values[i];
+        QString prefix = name(Event(e));
+        stats[prefix+"_count"] = int(values.size());
+        stats[prefix+"_per_second"] = values.size() / seconds;
+        stats[prefix+"_mean_us"] = values.empty() ? 0.0 : sum/values.size();
+        stats[prefix+"_p99_us"] = percentile(values, 0.99);
+    }
+
+    /// Sensor to screen, for the frames that were drawn
+    std::vector<double> latencies;
+    double sum = 0;
+    for(QHash<int,qint64>::const_iterator it=draws.begin(); it!=draws.end(); ++it){
+        if(!arrivals.contains(it.key())) continue;
+        latencies.push_back((it.value() - arrivals[it.key()]) / 1e6);
+        sum += latencies.back();
+    }
+    stats["latency_mean_ms"] = latencies.empty() ? 0.0 : sum/latencies.size();
+    stats["latency_p99_ms"] = percentile(latencies, 0.99);
+    return stats;
+}
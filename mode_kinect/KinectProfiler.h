@@ -0,0 +1,106 @@
+#pragma once
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QList>
+#include <QThreadStorage>
+#include <QVariantMap>
+
+/// Always-on timing of the Kinect processing path. Every thread records into
+/// a ring buffer of its own, so recording an event is a couple of stores (no
+/// lock, no allocation). Every event is tagged with the sensor it belongs to
+/// (see KinectHelper::sensorId, sensors number their frames independently),
+/// and statistics are computed on demand for one sensor, from the GUI, over
+/// the events that are still in the rings.
+class KinectProfiler{
+public:
+    enum Event{
+        ARRIVAL,   ///< a frame came out of OpenNI (instant)
+        ENQUEUE,   ///< handing it to the synchronizer
+        MATCH,     ///< pairing depth and color
+        FILTER,    ///< denoising the depth (see DepthFilter)
+        UNPROJECT, ///< consume_depth (including FILTER and NORMALS)
+        NORMALS,   ///< estimating the normals (see NormalEstimator)
+        COLOR,     ///< consume_color, the hand-off of the color frame
+        SWAP,      ///< publishing the pair to the GUI
+        CONSUME,   ///< a whole pair, from consume_depth to SWAP
+        WORK,      ///< a stage of the processing pipeline
+        DRAW,      ///< drawCloud
+        LOCK_WAIT, ///< waiting for a contended lock
+        EVENT_COUNT
+    };
+    static const char* name(Event event);
+
+    /// The profiler of the process
+    static KinectProfiler& instance();
+    /// Nanoseconds on a monotonic clock
+    qint64 now() const { return _clock.nsecsElapsed(); }
+    /// Records that "event" of frame "frame" (-1 if none) of a sensor lasted from start to end
+    void record(Event event, int sensor, int frame, qint64 start, qint64 end);
+    void record(Event event, int sensor, int frame){ qint64 t = now(); record(event, sensor, frame, t, t); }
+
+    /// Times the enclosing block
+    class Scope{
+    public:
+        Scope(Event event, int sensor, int frame=-1) : _event(event), _sensor(sensor), _frame(frame), _start(instance().now()){}
+        ~Scope(){ instance().record(_event, _sensor, _frame, _start, instance().now()); }
+        void setFrame(int frame){ _frame = frame; }
+    private:
+        Event _event;
+        int _sensor;
+        int _frame;
+        qint64 _start;
+    };
+
+    /// Over the last "window" nanoseconds, for the events of one sensor: for
+    /// every event "<name>_count", "<name>_per_second", "<name>_mean_us" and
+    /// "<name>_p99_us", plus the latency from arrival to draw ("latency_mean_ms",
+    /// "latency_p99_ms")
+    QVariantMap statistics(int sensor, qint64 window=2000000000ll) const;
+
+private:
+    KinectProfiler(){ _clock.start(); }
+    struct Record{
+        QAtomicInt sequence; ///< odd while being written
+        int event;
+        int sensor;
+        int frame;
+        qint64 start;
+        qint64 end;
+    };
+    enum{ RING_SIZE = 4096 }; ///< a power of two
+    struct Ring{
+        Ring() : head(0){}
+        Record records[RING_SIZE];
+        int head; ///< only touched by the owner thread
+    };
+    /// QThreadStorage deletes this when its thread ends, the ring goes back
+    /// to the free list (pool threads expire and are recreated all the time)
+    struct RingRef{
+        Ring* ring;
+        ~RingRef(){ instance().release(ring); }
+    };
+    Ring* ring();
+    void release(Ring* ring);
+    QElapsedTimer _clock;
+    QThreadStorage<RingRef*> _local;
+    mutable QMutex _rings_mutex; ///< taken when a thread starts or ends recording, and to read
+    QList<Ring*> _rings;         ///< all of them, as many as threads ever recorded at once
+    QList<Ring*> _free;          ///< rings of threads that ended, reused by the next ones
+};
+
+/// QMutexLocker that records the time spent waiting for a contended mutex
+class ProfiledMutexLocker{
+public:
+    /// The wait is accounted to "sensor"
+    ProfiledMutexLocker(QMutex* mutex, int sensor) : _mutex(mutex){
+        if(_mutex->tryLock()) return;
+        KinectProfiler& profiler = KinectProfiler::instance();
+        qint64 start = profiler.now();
+        _mutex->lock();
+        profiler.record(KinectProfiler::LOCK_WAIT, sensor, -1, start, profiler.now());
+    }
+    ~ProfiledMutexLocker(){ _mutex->unlock(); }
+private:
+    QMutex* _mutex;
+};
@@ -0,0 +1,278 @@
+#include "NormalEstimator.h"
+#include "FrameStage.h"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+NormalEstimator::NormalEstimator(float smoothing, float depthChange){
+    _smoothing = smoothing;
+    _depthChange = depthChange;
+    _width = 0;
+    _height = 0;
+    _reach = 0;
+    _rows = 0;
+}
+
+/// Eigenvector of the smallest eigenvalue of the symmetric matrix 
+/// {{a00,a01,a02},{a01,a11,a12},{a02,a12,a22}}. Its adjugate has the same
+/// eigenvectors with the eigenvalues l1*l2, l0*l2, l0*l1, so the normal is the
+/// dominant one: the column of the adjugate with the largest diagonal entry, 
+/// multiplied twice more by the adjugate, is the normal up to a tilt of about
+/// (l0/l1)^3 (under a degree for l0 < l1/5). That is exact enough wherever a
+/// normal makes sense (l0 << l1), and a few dozen multiplications instead of 
+/// the trigonometry of an exact eigen decomposition.
+static bool smallest_eigenvector(double a00, double a01, double a02, double a11, double a12, double a22, float* v){
+    /// Adjugate (symmetric)
+    double c00 = a11*a22 - a12*a12;
+    double c01 = a02*a12 - a01*a22;
+    double c02 = a01*a12 - a02*a11;
+    double c11 = a00*a22 - a02*a02;
+    double c12 = a01*a02 - a00*a12;
+    double c22 = a00*a11 - a01*a01;
+    double x, y, z;
+    if(c00>=c11 && c00>=c22){ x = c00; y = c01; z = c02; }
+    else if(c11>=c22)       { x = c01; y = c11; z = c12; }
+    else                    { x = c02; y = c12; z = c22; }
+    for(int i=0; i<2; i++){
+        double ex = c00*x + c01*y + c02*z;
+        double ey = c01*x + c11*y + c12*z;
+        double ez = c02*x + c12*y + c22*z;
+        x = ex; y = ey; z = ez;
+    }
+    double norm = std::sqrt(x*x + y*y + z*z);
+    if(!(norm > 0)) return false; ///< collinear points, no plane
+    v[0] = x/norm;
+    v[1] = y/norm;
+    v[2] = z/norm;
+    return true;
+}
+
+/// @{ tiles
+/// Prefix sums along the rows [first+begin,first+end) of the frame, into the
+/// rows of the integral image below them
+struct IntegrateRows{
+    void operator()(int begin, int end) const{
+        const float* xyz = frame.xyz();
+        const unsigned char* valid = frame.valid();
+        int width = frame.width();
+        for(int y=first+begin; y<first+end; y++){
+            NormalEstimator::Moments* row = integral + ((y+1)%rows)*(width+1);
+            std::memset(row, 0, sizeof(NormalEstimator::Moments));
+            for(int x=0; x<width; x++){
+                int i = y*width + x;
+                row[x+1] = row[x];
+                if(valid[i])
+                    row[x+1].add(xyz[3*i+0]-offset[0], xyz[3*i+1]-offset[1], xyz[3*i+2]-offset[2]);
+            }
+        }
+    }
+    const PointFrame& frame;
+    NormalEstimator::Moments* integral;
+    int rows;
+    int first;
+    const float* offset;
+};
+
+/// Prefix sums down the columns [begin,end) (tiles of columns, not of rows),
+/// from the row first to the row last of the integral image
+struct IntegrateColumns{
+    void operator()(int begin, int end) const{
+        for(int y=first+1; y<=last; y++){
+            NormalEstimator::Moments* row = integral + (y%rows)*(width+1);
+            const NormalEstimator::Moments* above = integral + ((y-1)%rows)*(width+1);
+            for(int x=begin; x<end; x++)
+                row[x] += above[x];
+        }
+    }
+    NormalEstimator::Moments* integral;
+    int width;
+    int rows;
+    int first;
+    int last;
+};
+
+struct NormalRows{
+    void operator()(int begin, int end) const{
+        const NormalEstimator& e = estimator;
+        const float* xyz = frame.xyz();
+        const unsigned char* valid = frame.valid();
+        float* normals = frame.normals();
+        int width = e._width, height = e._height;
+        for(int y=first+begin; y<first+end; y++){
+            for(int x=0; x<width; x++){
+                int i = y*width + x;
+                float* normal = normals + 3*i;
+                normal[0] = normal[1] = normal[2] = 0;
+                if(!valid[i]) continue;
+
+                /// Larger windows far away, but not across a discontinuity
+                const float* p = xyz + 3*i;
+                int radius = std::min(e._reach, int(std::min(float(e._edges[i]), e._smoothing * p[2] / 1000.0f)));
+                if(radius<1) continue;
+                int x0 = std::max(0, x-radius), x1 = std::min(width, x+radius+1);
+                int y0 = std::max(0, y-radius), y1 = std::min(height, y+radius+1);
+                const NormalEstimator::Moments* top = &e.integral(0,y0);
+                const NormalEstimator::Moments* bottom = &e.integral(0,y1);
+                double m[10];
+                const double *pa = &top[x0].n, *pb = &top[x1].n, *pc = &bottom[x0].n, *pd = &bottom[x1].n;
+                for(int k=0; k<10; k++) m[k] = pd[k] - pb[k] - pc[k] + pa[k];
+                double n = m[0];
+                if(n < 3) continue;
+
+                /// Covariance of the window, its smallest eigenvector is the normal
+                double mx = m[1]/n, my = m[2]/n, mz = m[3]/n;
+                if(!smallest_eigenvector(m[4]/n - mx*mx, m[5]/n - mx*my, m[6]/n - mx*mz,
+                                         m[7]/n - my*my, m[8]/n - my*mz, m[9]/n - mz*mz, normal))
+                    continue;
+
+                /// Facing the camera, which is at the origin
+                if(normal[0]*p[0] + normal[1]*p[1] + normal[2]*p[2] > 0){
+                    normal[0] = -normal[0];
+                    normal[1] = -normal[1];
+                    normal[2] = -normal[2];
+                }
+            }
+        }
+    }
+    const NormalEstimator& estimator;
+    PointFrame& frame;
+    int first;
+};
+
+/// Both pixels of a large depth jump are on an edge (0), the others are as
+/// far as can be (255)
+struct EdgeRows{
+    void operator()(int begin, int end) const{
+        int width = frame.width(), height = frame.height();
+        for(int y=begin; y<end; y++){
+            for(int x=0; x<width; x++){
+                int i = y*width + x;
+                float d = frame.depthAt(i);
+                bool edge = (x>0 && jump(frame.depthAt(i-1), d)) || (x+1<width && jump(d, frame.depthAt(i+1)))
+                         || (y>0 && jump(frame.depthAt(i-width), d)) || (y+1<height && jump(d, frame.depthAt(i+width)));
+                edges[i] = edge ? 0 : 255;
+            }
+        }
+    }
+    /// The jump is relative to the depth of the left (upper) of the two pixels
+    bool jump(float first, float second) const {
+        return first && second && std::abs(second-first) > depthChange*first;
+    }
+    const PointFrame& frame;
+    float depthChange;
+    unsigned char* edges;
+};
+
+/// Distance to the closest edge in the same column, down then up the columns 
+/// [begin,end) (tiles of columns, not of rows)
+struct DistanceColumns{
+    void operator()(int begin, int end) const{
+        for(int y=1; y<height; y++){
+            unsigned char* row = edges + y*width;
+            for(int x=begin; x<end; x++)
+                row[x] = std::min(int(row[x]), row[x-width]+1);
+        }
+        for(int y=height-2; y>=0; y--){
+            unsigned char* row = edges + y*width;
+            for(int x=begin; x<end; x++)
+                row[x] = std::min(int(row[x]), row[x+width]+1);
+        }
+    }
+    unsigned char* edges;
+    int width;
+    int height;
+};
+
+/// Chessboard distance along the rows, from the distances g down the columns:
+/// min over i of max(|x-i|, g(i)), the lower envelope of the functions of the
+/// pixels of the row (Meijster et al., "A general algorithm for computing 
+/// distance transforms in linear time").
+struct DistanceRows{
+    void operator()(int begin, int end) const{
+        std::vector<int> g(width), s(width), t(width);
+        for(int y=begin; y<end; y++){
+            unsigned char* row = edges + y*width;
+            std::copy(row, row+width, g.begin());
+            
+            /// s: the pixels of the envelope, t: where each one starts winning
+            int q = 0;
+            s[0] = t[0] = 0;
+            for(int u=1; u<width; u++){
+                while(q>=0 && f(g, t[q], s[q]) > f(g, t[q], u)) q--;
+                if(q<0){ q = 0; s[0] = u; continue; }
+                int w = 1 + sep(g, s[q], u);
+                if(w<width){ q++; s[q] = u; t[q] = w; }
+            }
+            for(int u=width-1; u>=0; u--){
+                row[u] = std::min(255, f(g, u, s[q]));
+                if(u==t[q]) q--;
+            }
+        }
+    }
+    static int f(const std::vector<int>& g, int x, int i){ return std::max(std::abs(x-i), g[i]); }
+    /// The last x where the pixel i is at most as far as the pixel u > i
+    static int sep(const std::vector<int>& g, int i, int u){
+        if(g[i] <= g[u]) return std::max(i + g[u], (i+u)/2);
+        return std::min(u - g[i], (i+u)/2);
+    }
+    unsigned char* edges;
+    int width;
+};
+/// @}
+
+void NormalEstimator::integrate(const PointFrame& frame, int first, int last){
+    IntegrateRows rows = { frame, &_integral[0], _rows, first, _offset };
+    FrameStage::forEachRowTile(last-first, rows, 8);
+    IntegrateColumns columns = { &_integral[0], _width, _rows, first, last };
+    FrameStage::forEachRowTile(_width+1, columns, 64);
+}
+
+void NormalEstimator::find_edges(const PointFrame& frame){
+    _edges.resize(_width*_height);
+    EdgeRows marks = { frame, _depthChange, &_edges[0] };
+    FrameStage::forEachRowTile(_height, marks);
+    
+    /// Chessboard distance transform, separable: the windows are squares, a
+    /// window of that radius reaches the closest edge and no farther (the 
+    /// city block distance overshoots along the diagonals)
+    DistanceColumns columns = { &_edges[0], _width, _height };
+    FrameStage::forEachRowTile(_width, columns, 64);
+    DistanceRows rows = { &_edges[0], _width };
+    FrameStage::forEachRowTile(_height, rows);
+}
+
+void NormalEstimator::estimate(PointFrame& frame){
+    frame.setHasNormals(false);
+    if(!frame.unprojected() || frame.empty()) return;
+    _width = frame.width();
+    _height = frame.height();
+    
+    /// Sums of products of large coordinates lose precision, center them
+    for(int c=0; c<3; c++)
+        _offset[c] = frame.hasBounds() ? (frame.bounds()[c] + frame.bounds()[3+c]) / 2 : 0;
+    
+    find_edges(frame);
+    frame.setHasNormals(true);
+    
+    /// A band of rows at a time, keeping the rows of the integral image its
+    /// windows reach: 10 doubles per pixel of the whole frame are about 25MB,
+    /// and floats would lose the covariance of a window to the cancellation
+    /// of its four corners
+    const int band = 64;
+    float depth = frame.hasBounds() ? frame.bounds()[5] : 65535;
+    _reach = int(std::min(255.0f, _smoothing * depth / 1000.0f));
+    _rows = std::min(_height, band + 2*_reach) + 1;
+    _integral.resize(_rows*(_width+1));
+    std::memset(&_integral[0], 0, (_width+1)*sizeof(Moments)); ///< first row
+    int integrated = 0; ///< rows of the integral image up to this one are done
+    for(int first=0; first<_height; first+=band){
+        int last = std::min(_height, first+band);
+        int needed = std::min(_height, last+_reach);
+        if(needed > integrated){
+            integrate(frame, integrated, needed);
+            integrated = needed;
+        }
+        NormalRows rows = { *this, frame, first };
+        FrameStage::forEachRowTile(last-first, rows, 8);
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include "PointFrame.h"
+
+/// Estimates the normals of an organized PointFrame in constant time per
+/// pixel. The count, sum and sum of products of the point coordinates are 
+/// accumulated into an integral image, so the covariance of any window of
+/// pixels costs four lookups, and its smallest eigenvector is the normal.
+/// Windows grow with the depth (the sensor gets noisier), but shrink near 
+/// depth discontinuities so that the two sides of an edge don't get mixed.
+/// Rows are processed in parallel, a band at a time: only the rows of the 
+/// integral image that the windows of the band reach are kept.
+class NormalEstimator{
+public:
+    /// smoothing: radius of the window at 1m, in pixels
+    /// depthChange: depth difference between neighbors, relative to their 
+    ///   depth, that makes a discontinuity
+    NormalEstimator(float smoothing=4, float depthChange=0.02f);
+    void setSmoothing(float smoothing){ _smoothing = smoothing; }
+    void setDepthChange(float depthChange){ _depthChange = depthChange; }
+
+    /// Fills the normals of an unprojected frame
+    void estimate(PointFrame& frame);
+
+    /// Sums over the valid points of a region of the frame
+    struct Moments{
+        double n, x, y, z, xx, xy, xz, yy, yz, zz;
+        void add(double px, double py, double pz){
+            n += 1; x += px; y += py; z += pz;
+            xx += px*px; xy += px*py; xz += px*pz; yy += py*py; yz += py*pz; zz += pz*pz;
+        }
+        Moments& operator+=(const Moments& m){
+            double* a = &n; const double* b = &m.n;
+            for(int i=0; i<10; i++) a[i] += b[i];
+            return *this;
+        }
+    };
+
+private:
+    /// Moments of the rectangle [0,x) x [0,y) of the frame, for the rows
+    /// that are still kept
+    const Moments& integral(int x, int y) const { return _integral[(y%_rows)*(_width+1)+x]; }
+    void integrate(const PointFrame& frame, int first, int last);
+    void find_edges(const PointFrame& frame);
+    friend struct NormalRows;
+    float _smoothing;
+    float _depthChange;
+    int _width;
+    int _height;
+    float _offset[3];                  ///< subtracted from the points, for precision
+    int _reach;                        ///< largest radius of a window
+    int _rows;                         ///< rows of the integral image kept
+    std::vector<Moments> _integral;    ///< _rows x (width+1), row y at y % _rows
+    std::vector<unsigned char> _edges; ///< chessboard distance to the closest discontinuity, in pixels
+};
@@ -0,0 +1,102 @@
+#pragma once
+#include <vector>
+#include <Eigen/Core>
+
+/// An organized (height x width) frame of points, stored row-major as packed
+/// float xyz so that it can be handed to SIMD kernels and to OpenGL vertex
+/// arrays without conversion. Pixels without a depth measurement are flagged
+/// in the validity mask (their point is at the origin). The raw depth image
+/// (when it was kept, see hasDepth) and the camera intrinsics the points were
+/// computed from travel along, as well as the bounding box of the valid points
+/// and, if they were estimated (see NormalEstimator), the normals of the points.
+class PointFrame{
+public:
+    typedef Eigen::Map<Eigen::Vector3f> Point;
+    typedef Eigen::Map<const Eigen::Vector3f> ConstPoint;
+
+    PointFrame() : _width(0), _height(0), _index(-1), _sensor(-1), _unprojected(false), _hasNormals(false), _hasDepth(true), _xzFactor(0), _yzFactor(0){
+        for(int c=0; c<3; c++){ _bounds[c] = 1; _bounds[3+c] = -1; }
+    }
+    void resize(int width, int height){
+        _width = width;
+        _height = height;
+        _depth.resize(width*height);
+        _xyz.resize(3*width*height);
+        _valid.resize(width*height);
+        if(!_normals.empty()) _normals.resize(3*width*height);
+    }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    int size() const { return _width*_height; }
+    bool empty() const { return size()==0; }
+    /// Index of the sensor frame these points come from
+    int index() const { return _index; }
+    void setIndex(int index){ _index = index; }
+    /// Sensor the frame comes from, see KinectHelper::sensorId
+    int sensor() const { return _sensor; }
+    void setSensor(int sensor){ _sensor = sensor; }
+    /// Were xyz() and valid() computed? (not when unprojecting on the GPU)
+    bool unprojected() const { return _unprojected; }
+    void setUnprojected(bool unprojected){ _unprojected = unprojected; }
+    /// Were normals() computed for these points? (memory is allocated on the first call)
+    bool hasNormals() const { return _hasNormals; }
+    void setHasNormals(bool hasNormals){ 
+        _hasNormals = hasNormals; 
+        if(hasNormals) _normals.resize(_xyz.size()); 
+    }
+    /// Was the raw depth kept in depth()? Unprojected frames may skip the copy,
+    /// the z of their points is the depth (see depthAt)
+    bool hasDepth() const { return _hasDepth; }
+    void setHasDepth(bool hasDepth){ _hasDepth = hasDepth; }
+    /// Depth of pixel i, from depth() or from the points
+    unsigned short depthAt(int i) const { return _hasDepth ? _depth[i] : (unsigned short) _xyz[3*i+2]; }
+    /// Intrinsics of the depth camera, see DepthUnprojector
+    float xzFactor() const { return _xzFactor; }
+    float yzFactor() const { return _yzFactor; }
+    void setIntrinsics(float xzFactor, float yzFactor){ _xzFactor = xzFactor; _yzFactor = yzFactor; }
+
+    /// Bounding box of the valid points, filled while unprojecting
+    bool hasBounds() const { return _bounds[0]<=_bounds[3] && _bounds[1]<=_bounds[4] && _bounds[2]<=_bounds[5]; }
+    Eigen::Vector3f boundsMin() const { return Eigen::Vector3f(_bounds[0], _bounds[1], _bounds[2]); }
+    Eigen::Vector3f boundsMax() const { return Eigen::Vector3f(_bounds[3], _bounds[4], _bounds[5]); }
+
+    /// @{ raw access (row-major, 1 depth value, 3 floats per point, 1 byte per mask entry)
+    /// @note depth() is only meaningful if hasDepth()
+    unsigned short* depth(){ return _depth.empty() ? NULL : &_depth[0]; }
+    const unsigned short* depth() const { return _depth.empty() ? NULL : &_depth[0]; }
+    float* xyz(){ return _xyz.empty() ? NULL : &_xyz[0]; }
+    const float* xyz() const { return _xyz.empty() ? NULL : &_xyz[0]; }
+    /// Unit normals facing the camera, (0,0,0) where none could be estimated
+    float* normals(){ return _normals.empty() ? NULL : &_normals[0]; }
+    const float* normals() const { return _normals.empty() ? NULL : &_normals[0]; }
+    unsigned char* valid(){ return _valid.empty() ? NULL : &_valid[0]; }
+    const unsigned char* valid() const { return _valid.empty() ? NULL : &_valid[0]; }
+    /// {minx, miny, minz, maxx, maxy, maxz}, min > max if there is no valid point
+    float* bounds(){ return _bounds; }
+    const float* bounds() const { return _bounds; }
+    /// @}
+
+    /// @{ per pixel access
+    Point point(int x, int y){ return Point(&_xyz[3*(y*_width+x)]); }
+    ConstPoint point(int x, int y) const { return ConstPoint(&_xyz[3*(y*_width+x)]); }
+    ConstPoint normal(int x, int y) const { return ConstPoint(&_normals[3*(y*_width+x)]); }
+    bool isValid(int x, int y) const { return _valid[y*_width+x] != 0; }
+    /// @}
+
+private:
+    int _width;
+    int _height;
+    int _index;
+    int _sensor;
+    bool _unprojected;
+    bool _hasNormals;
+    bool _hasDepth;
+    float _xzFactor;
+    float _yzFactor;
+    float _bounds[6];
+    std::vector<unsigned short> _depth;
+    std::vector<float> _xyz;
+    std::vector<unsigned char> _valid;
+    std::vector<float> _normals;
+};
@@ -0,0 +1,254 @@
+#include "RawFrameFile.h"
+#include <cstring>
+#include <QDebug>
+
+/// @{ DEPTH_DELTA codes, by their first byte
+/// 0xxxxxxx                     zigzag difference < 128
+/// 10xxxxxx xxxxxxxx            zigzag difference < 16384
+/// 110nnnnn                     n+2 zero differences
+/// 11100000 llllllll hhhhhhhh   the pixel itself
+enum{ RUN_CODE = 0xC0, MAX_RUN = 33, PIXEL_CODE = 0xE0 };
+/// @}
+
+int RawFrameFile::encodeDepth(const openni::DepthPixel* depth, int width, int height, uchar* out){
+    uchar* begin = out;
+    for(int y=0; y<height; y++){
+        const openni::DepthPixel* row = depth + y*width;
+        int predicted = y ? row[-width] : 0;
+        for(int x=0; x<width; ){
+            int difference = int(row[x]) - predicted;
+            if(difference==0){
+                int run = 1;
+                while(x+run<width && run<MAX_RUN && row[x+run]==row[x]) run++;
+                if(run>=2) *out++ = RUN_CODE | (run-2);
+                else       *out++ = 0;
+                x += run;
+                continue;
+            }
+            unsigned zigzag = (unsigned(difference)<<1) ^ unsigned(difference>>31);
+            if(zigzag < 0x80){
+                *out++ = zigzag;
+            } else if(zigzag < 0x4000){
+                *out++ = 0x80 | (zigzag>>8);
+                *out++ = zigzag & 0xFF;
+            } else {
+                *out++ = PIXEL_CODE;
+                *out++ = row[x] & 0xFF;
+                *out++ = row[x] >> 8;
+            }
+            predicted = row[x];
+            x++;
+        }
+    }
+    return out - begin;
+}
+
+bool RawFrameFile::decodeDepth(const uchar* in, int size, int width, int height, openni::DepthPixel* depth){
+    const uchar* end = in + size;
+    for(int y=0; y<height; y++){
+        openni::DepthPixel* row = depth + y*width;
+        int predicted = y ? row[-width] : 0;
+        for(int x=0; x<width; ){
+            if(in>=end) return false;
+            uchar code = *in++;
+            if(code < 0x80){
+                row[x++] = predicted += (code>>1) ^ -int(code&1);
+            } else if(code < RUN_CODE){
+                if(in>=end) return false;
+                unsigned zigzag = (unsigned(code&0x3F)<<8) | *in++;
+                row[x++] = predicted += int(zigzag>>1) ^ -int(zigzag&1);
+            } else if(code < PIXEL_CODE){
+                int run = (code & 0x1F) + 2;
+                if(x+run>width) return false;
+                for(int i=0; i<run; i++) row[x++] = predicted;
+            } else {
+                if(code!=PIXEL_CODE || in+2>end) return false;
+                predicted = in[0] | (in[1]<<8);
+                in += 2;
+                row[x++] = predicted;
+            }
+        }
+    }
+    return in==end;
+}
+
+bool RawFrameReader::open(const QString& path){
+    close();
+    _file.setFileName(path);
+    if(!_file.open(QIODevice::ReadOnly)){
+        qDebug() << "RawFrameReader: cannot open" << path;
+        return false;
+    }
+    if(_file.read((char*) &_header, sizeof(_header)) != sizeof(_header)
+       || std::strncmp(_header.magic, "KRAW", 4) != 0 || _header.version<1 || _header.version>2
+       || (_header.version<2 && _header.compression!=RawFrameFile::DEPTH_RAW)
+       || _header.compression>RawFrameFile::DEPTH_DELTA){
+        qDebug() << "RawFrameReader: not a raw frame file" << path;
+        _file.close();
+        return false;
+    }
+    /// Far beyond any sensor, and would overflow the sizes of the records
+    if(_header.width==0 || _header.height==0 || _header.width>MAX_SIDE || _header.height>MAX_SIDE
+       || _header.colorWidth>MAX_SIDE || _header.colorHeight>MAX_SIDE){
+        qDebug() << "RawFrameReader: absurd frame size in" << path;
+        _file.close();
+        return false;
+    }
+    _map = _file.map(0, _file.size());
+    if(_map == NULL){
+        qDebug() << "RawFrameReader: cannot map" << path;
+        _file.close();
+        return false;
+    }
+    /// A truncated recording still plays the frames it has
+    index_records();
+    _header.count = _offsets.size();
+    return true;
+}
+
+void RawFrameReader::index_records(){
+    using namespace RawFrameFile;
+    _offsets.clear();
+    qint64 size = _file.size();
+    qint64 colorBytes = qint64(_header.colorWidth)*_header.colorHeight*3;
+    if(_header.version<2){
+        qint64 available = (size - qint64(sizeof(Header))) / recordSize(_header);
+        for(qint64 i=0; i<qMin<qint64>(_header.count, available); i++)
+            _offsets.push_back(sizeof(Header) + i*recordSize(_header));
+        return;
+    }
+
+    /// The index of a closed recording (which ends aligned, as its records)
+    if(size >= qint64(sizeof(Header) + sizeof(IndexFooter)) && size%8==0){
+        const IndexFooter* footer = (const IndexFooter*)(_map + size - sizeof(IndexFooter));
+        qint64 table = footer->offset;
+        if(std::strncmp(footer->magic, "KIDX", 4)==0 && table>=qint64(sizeof(Header))
+           && table + qint64(footer->count)*sizeof(quint64) + qint64(sizeof(IndexFooter)) == size){
+            const quint64* offsets = (const quint64*)(_map + table);
+            for(quint32 i=0; i<footer->count; i++){
+                if(offsets[i] < sizeof(Header) || offsets[i]%8 != 0
+                   || offsets[i] + sizeof(FrameHeader) > quint64(table))
+                    break;
+                const FrameHeader* frame = (const FrameHeader*)(_map + offsets[i]);
+                if(!valid_depth(frame->depthBytes)
+                   || offsets[i] + sizeof(FrameHeader) + frame->depthBytes + colorBytes > quint64(table))
+                    break;
+                _offsets.push_back(offsets[i]);
+            }
+            return;
+        }
+    }
+
+    /// Otherwise walk through the records, up to the last complete one
+    qint64 offset = sizeof(Header);
+    while(offset + qint64(sizeof(FrameHeader)) <= size){
+        const FrameHeader* frame = (const FrameHeader*)(_map + offset);
+        if(!valid_depth(frame->depthBytes)) break;
+        qint64 next = offset + paddedSize(sizeof(FrameHeader) + frame->depthBytes + colorBytes);
+        if(next > size) break;
+        _offsets.push_back(offset);
+        offset = next;
+    }
+}
+
+bool RawFrameReader::valid_depth(quint32 bytes) const{
+    qint64 raw = qint64(_header.width)*_header.height*sizeof(openni::DepthPixel);
+    if(_header.compression==RawFrameFile::DEPTH_RAW) return bytes == raw;
+    return bytes <= RawFrameFile::maxEncodedSize(_header.width, _header.height);
+}
+
+const openni::DepthPixel* RawFrameReader::depth(int i){
+    const uchar* data = (const uchar*)(frame(i)+1);
+    if(_header.compression==RawFrameFile::DEPTH_RAW)
+        return (const openni::DepthPixel*) data;
+    if(_decoded_frame!=i){
+        _decoded.resize(_header.width*_header.height);
+        if(!RawFrameFile::decodeDepth(data, frame(i)->depthBytes, _header.width, _header.height, &_decoded[0])){
+            qDebug() << "RawFrameReader: corrupt depth in frame" << i;
+            std::fill(_decoded.begin(), _decoded.end(), 0);
+        }
+        _decoded_frame = i;
+    }
+    return &_decoded[0];
+}
+
+void RawFrameReader::close(){
+    if(_map) _file.unmap(_map);
+    _map = NULL;
+    _offsets.clear();
+    _decoded_frame = -1;
+    if(_file.isOpen()) _file.close();
+}
+
+bool RawFrameWriter::open(const QString& path, int width, int height, int colorWidth, int colorHeight, float hfov, float vfov, int compression){
+    close();
+    std::memcpy(_header.magic, "KRAW", 4);
+    _header.version = 2;
+    _header.width = width;
+    _header.height = height;
+    _header.colorWidth = colorWidth;
+    _header.colorHeight = colorHeight;
+    _header.hfov = hfov;
+    _header.vfov = vfov;
+    _header.count = 0;
+    _header.compression = compression;
+    _offsets.clear();
+    if(compression!=RawFrameFile::DEPTH_RAW)
+        _encoded.resize(RawFrameFile::maxEncodedSize(width, height));
+
+    _file.setFileName(path);
+    if(!_file.open(QIODevice::WriteOnly | QIODevice::Truncate)){
+        qDebug() << "RawFrameWriter: cannot open" << path;
+        return false;
+    }
+    return _file.write((const char*) &_header, sizeof(_header)) == sizeof(_header);
+}
+
+bool RawFrameWriter::write(quint64 timestamp, int index, const openni::DepthPixel* depth, const uchar* color, int colorStride){
+    if(!_file.isOpen()) return false;
+    const char* depthData = (const char*) depth;
+    qint64 depthBytes = qint64(_header.width)*_header.height*sizeof(openni::DepthPixel);
+    if(_header.compression==RawFrameFile::DEPTH_DELTA){
+        depthBytes = RawFrameFile::encodeDepth(depth, _header.width, _header.height, &_encoded[0]);
+        depthData = (const char*) &_encoded[0];
+    }
+    RawFrameFile::FrameHeader frame;
+    frame.timestamp = timestamp;
+    frame.index = index;
+    frame.depthBytes = depthBytes;
+    qint64 offset = _file.pos();
+    qint64 lineBytes = qint64(_header.colorWidth)*3;
+    bool ok = _file.write((const char*) &frame, sizeof(frame)) == sizeof(frame)
+           && _file.write(depthData, depthBytes) == depthBytes;
+    if(colorStride==0 || colorStride==lineBytes){
+        ok = ok && _file.write((const char*) color, lineBytes*_header.colorHeight) == lineBytes*_header.colorHeight;
+    } else {
+        for(quint32 y=0; ok && y<_header.colorHeight; y++)
+            ok = _file.write((const char*) (color + y*colorStride), lineBytes) == lineBytes;
+    }
+    static const char padding[8] = {0};
+    qint64 written = _file.pos() - offset;
+    ok = ok && _file.write(padding, RawFrameFile::paddedSize(written) - written) == RawFrameFile::paddedSize(written) - written;
+    if(ok){
+        _offsets.push_back(offset);
+        _header.count++;
+    } else {
+        /// Leave no partial record behind, the index must match the records
+        _file.resize(offset);
+        _file.seek(offset);
+    }
+    return ok;
+}
+
+void RawFrameWriter::close(){
+    if(!_file.isOpen()) return;
+    RawFrameFile::IndexFooter footer;
+    std::memcpy(footer.magic, "KIDX", 4);
+    footer.count = _offsets.size();
+    footer.offset = _file.pos();
+    _file.write((const char*) _offsets.constData(), _offsets.size()*sizeof(quint64));
+    _file.write((const char*) &footer, sizeof(footer));
+    _file.seek(0);
+    _file.write((const char*) &_header, sizeof(_header));
+    _file.close();
+}
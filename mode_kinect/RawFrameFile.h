@@ -0,0 +1,135 @@
+#pragma once
+#include <vector>
+#include <QFile>
+#include <QString>
+#include <QVector>
+#include "OpenNI.h"
+
+/// A simple dump of synchronized depth/color frames (".kraw"), meant for
+/// synthetic data and for replaying without OpenNI. The file is a Header
+/// followed by one record per frame: a FrameHeader, the 16bit depth image and
+/// the RGB888 color image (row-major, no padding). Native endianness.
+/// Version 1 stores the depth as is, so records have a fixed size. Version 2
+/// may compress the depth (DEPTH_DELTA), records then have the size of their
+/// depth (padded to 8 bytes), and the offsets of the records follow the last
+/// one (IndexFooter) for random access. A recording that was not closed has no index, it is
+/// rebuilt by walking through the records.
+namespace RawFrameFile{
+    enum Compression{
+        DEPTH_RAW = 0,   ///< 16bit pixels
+        DEPTH_DELTA = 1  ///< difference to the left pixel, see encodeDepth()
+    };
+    struct Header{
+        char magic[4];        ///< "KRAW"
+        quint32 version;      ///< 1 or 2
+        quint32 width;        ///< of the depth image
+        quint32 height;
+        quint32 colorWidth;
+        quint32 colorHeight;
+        float hfov;           ///< field of view of the depth camera (radians)
+        float vfov;
+        quint32 count;        ///< number of frames
+        quint32 compression;  ///< of the depth (version 2, 0 before)
+    };
+    struct FrameHeader{
+        quint64 timestamp;    ///< microseconds
+        quint32 index;        ///< sensor frame index
+        quint32 depthBytes;   ///< size of the depth that follows (version 2, 0 before)
+    };
+    /// Last bytes of a version 2 file, after the table of the offsets of the
+    /// "count" records (quint64 each, from the start of the file)
+    struct IndexFooter{
+        char magic[4];        ///< "KIDX"
+        quint32 count;
+        quint64 offset;       ///< of the table
+    };
+    /// Size of the record of one frame (version 1)
+    inline qint64 recordSize(const Header& header){
+        return sizeof(FrameHeader) + qint64(header.width)*header.height*sizeof(openni::DepthPixel)
+                                   + qint64(header.colorWidth)*header.colorHeight*3;
+    }
+    /// Size of a record of version 2, padded so that the next one is aligned
+    inline qint64 paddedSize(qint64 bytes){ return (bytes + 7) & ~qint64(7); }
+    inline bool isRawFile(const QString& path){ return path.endsWith(".kraw", Qt::CaseInsensitive); }
+
+    /// @{ DEPTH_DELTA: every pixel is predicted by its left neighbor (by the
+    /// one above for the first of a row) and the difference is stored in 1
+    /// byte if small, in 2 if not, as the pixel itself in 3 if large; runs of
+    /// zero differences (flat surfaces, holes) take 1 byte. Kinect depth
+    /// shrinks to half its size or less, and decodes in well under a ms.
+
+    /// Size of the largest encoding of a width x height image
+    inline int maxEncodedSize(int width, int height){ return 3*width*height; }
+    /// Returns the number of bytes written to out
+    int encodeDepth(const openni::DepthPixel* depth, int width, int height, uchar* out);
+    /// False if the data is corrupt
+    bool decodeDepth(const uchar* in, int size, int width, int height, openni::DepthPixel* depth);
+    /// @}
+}
+
+/// Reads a .kraw file through a memory map, frames are not copied (except
+/// the compressed depth, which is decoded)
+class RawFrameReader{
+public:
+    RawFrameReader() : _map(NULL), _decoded_frame(-1){}
+    ~RawFrameReader(){ close(); }
+    /// False if the file can't be mapped or is not a valid dump
+    bool open(const QString& path);
+    void close();
+
+    const RawFrameFile::Header& header() const { return _header; }
+    int count() const { return _header.count; }
+    /// @{ data of frame i, valid while the file is open
+    quint64 timestamp(int i) const { return frame(i)->timestamp; }
+    int index(int i) const { return frame(i)->index; }
+    /// @note compressed depth is decoded into a buffer of the reader, which
+    /// is valid until the depth of another frame is asked for
+    const openni::DepthPixel* depth(int i);
+    const uchar* color(int i) const { return (const uchar*)(frame(i)+1) + depthBytes(i); }
+    /// @}
+
+private:
+    const RawFrameFile::FrameHeader* frame(int i) const {
+        return (const RawFrameFile::FrameHeader*)(_map + _offsets[i]);
+    }
+    qint64 depthBytes(int i) const {
+        if(_header.version<2) return qint64(_header.width)*_header.height*sizeof(openni::DepthPixel);
+        return frame(i)->depthBytes;
+    }
+    /// Fills _offsets from the index, or from the records if there is none,
+    /// up to the first record that does not fit in the file
+    void index_records();
+    /// Whether a record may hold that many bytes of depth
+    bool valid_depth(quint32 bytes) const;
+    /// Largest side of a frame that open() accepts
+    enum{ MAX_SIDE = 8192 };
+    QFile _file;
+    uchar* _map;
+    RawFrameFile::Header _header;
+    QVector<qint64> _offsets; ///< of the records
+    std::vector<openni::DepthPixel> _decoded;
+    int _decoded_frame;       ///< frame in _decoded, -1 if none
+};
+
+/// Writes a .kraw file, one frame at a time (see FrameRecorder to do so in
+/// the background)
+class RawFrameWriter{
+public:
+    ~RawFrameWriter(){ close(); }
+    bool open(const QString& path, int width, int height, int colorWidth, int colorHeight, float hfov, float vfov,
+              int compression=RawFrameFile::DEPTH_RAW);
+    /// Appends a frame, the images must have the sizes given to open()
+    /// (colorStride: bytes per line of color, 0 if packed)
+    bool write(quint64 timestamp, int index, const openni::DepthPixel* depth, const uchar* color, int colorStride=0);
+    /// Writes the index and the number of frames in the header
+    void close();
+    bool isOpen() const { return _file.isOpen(); }
+    /// Frames written so far
+    int count() const { return _header.count; }
+
+private:
+    QFile _file;
+    RawFrameFile::Header _header;
+    QVector<quint64> _offsets;  ///< of the records
+    std::vector<uchar> _encoded; ///< depth of the current frame
+};
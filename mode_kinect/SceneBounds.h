@@ -0,0 +1,45 @@
+#pragma once
+#include <algorithm>
+#include <Eigen/Geometry>
+
+/// Follows the bounding box of a stream of frames. The per-frame boxes are
+/// low-pass filtered, and a new box is only reported once the filtered one
+/// moved away from the last reported box by more than a fraction of its size.
+/// Sensor noise and people walking by thus do not keep moving the camera, 
+/// while a new scene is picked up within a second.
+class SceneBounds{
+public:
+    /// smoothing: weight of a new frame in the filtered box (0..1]
+    /// threshold: motion that triggers a report, relative to the box diagonal
+    SceneBounds(float smoothing=0.1f, float threshold=0.15f) 
+        : _smoothing(smoothing), _threshold(threshold){ reset(); }
+    /// Forgets the scene, the next frame is reported right away
+    void reset(){ _box.setEmpty(); }
+    
+    /// Folds in the box of a frame (see PointFrame::bounds), true if box() changed
+    bool update(const Eigen::Vector3f& min, const Eigen::Vector3f& max){
+        if(!(min.array() <= max.array()).all()) return false; ///< no valid pixel
+        if(_box.isEmpty()){
+            _min = min;
+            _max = max;
+            _box = Eigen::AlignedBox3f(min, max);
+            return true;
+        }
+        _min += _smoothing * (min - _min);
+        _max += _smoothing * (max - _max);
+        float motion = std::max((_min - _box.min()).cwiseAbs().maxCoeff(),
+                                (_max - _box.max()).cwiseAbs().maxCoeff());
+        if(motion <= _threshold * _box.diagonal().norm()) return false;
+        _box = Eigen::AlignedBox3f(_min, _max);
+        return true;
+    }
+    /// Last reported box, empty until a frame with valid pixels arrived
+    const Eigen::AlignedBox3f& box() const { return _box; }
+
+private:
+    float _smoothing;
+    float _threshold;
+    Eigen::Vector3f _min; ///< filtered
+    Eigen::Vector3f _max; ///< filtered
+    Eigen::AlignedBox3f _box;
+};
@@ -0,0 +1,79 @@
+#pragma once
+#include <QAtomicInt>
+
+/// Lock-free exchange of the latest value between one producer thread and one
+/// consumer thread. The producer fills back() and publish()es it by swapping
+/// it with the middle slot; the consumer swaps the middle slot into front()
+/// only when it holds something newer. Neither side ever waits for the other,
+/// values the consumer didn't get to are simply overwritten.
+template <class T>
+class TripleBuffer{
+    enum{ INDEX_MASK = 3, NEW_BIT = 4 }; ///< layout of _middle
+public:
+    TripleBuffer() : _back(0), _middle(1), _front(2), _produced(0), _readers(0){
+        for(int i=0; i<3; i++) _sequence[i] = 0;
+    }
+    /// Initializes the three slots (before the producer starts)
+    void fill(const T& value){
+        for(int i=0; i<3; i++) _slots[i] = value;
+    }
+
+/// @{ producer side
+    /// Slot being written, not visible to the consumer
+    T& back(){ return _slots[_back]; }
+    /// Makes back() the latest value and hands out a free slot as the new back()
+    void publish(){
+        _sequence[_back] = ++_produced;
+        _back = _middle.fetchAndStoreOrdered(_back | NEW_BIT) & INDEX_MASK;
+    }
+/// @}
+
+/// @{ consumer side
+    /// Moves the latest published value to front(). Returns false if nothing
+    /// was published since the last call, or if a Reader is holding front()
+    bool acquire(){
+        if(_readers>0) return false;
+        if(!(_middle.fetchAndAddRelaxed(0) & NEW_BIT)) return false;
+        _front = _middle.fetchAndStoreOrdered(_front) & INDEX_MASK;
+        return true;
+    }
+    T& front(){ return _slots[_front]; }
+    const T& front() const { return _slots[_front]; }
+    /// Publication number of front(), 0 if nothing was published yet
+    quint64 sequence() const { return _sequence[_front]; }
+/// @}
+
+public:
+    /// Stable snapshot of the latest value: front() is not replaced while a
+    /// Reader is alive, so nested readers see the same value.
+    /// @note consumer thread only
+    class Reader{
+    public:
+        Reader(TripleBuffer& buffer) : _buffer(buffer){
+            _new = buffer.acquire();
+            _buffer._readers++;
+        }
+        ~Reader(){ _buffer._readers--; }
+        T& operator*(){ return _buffer.front(); }
+        T* operator->(){ return &_buffer.front(); }
+        /// Did this reader bring in a value that was not read before?
+        bool isNew() const { return _new; }
+        /// Has anything been published at all?
+        bool isValid() const { return _buffer.sequence() > 0; }
+        quint64 sequence() const { return _buffer.sequence(); }
+    private:
+        Reader(const Reader&);
+        Reader& operator=(const Reader&);
+        TripleBuffer& _buffer;
+        bool _new;
+    };
+
+private:
+    T _slots[3];
+    quint64 _sequence[3]; ///< publication number of every slot
+    int _back;            ///< owned by the producer
+    QAtomicInt _middle;   ///< shared, index | NEW_BIT if not acquired yet
+    int _front;           ///< owned by the consumer
+    quint64 _produced;    ///< publications so far (producer)
+    int _readers;         ///< live Readers (consumer)
+};
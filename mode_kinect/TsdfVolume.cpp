@@ -0,0 +1,441 @@
+#include "TsdfVolume.h"
+#include "FrameStage.h"
+#include <Eigen/Geometry>
+#include <cmath>
+#include <algorithm>
+
+/// @{ marching cubes tables
+/// Corner c of a cell is at (c&1, (c>>1)&1, (c>>2)&1). Edge e runs along
+/// axis e/4 from the corner edge_corner[e], to that corner + the axis.
+/// Rather than the usual hand written table, the triangles of the 256 cases
+/// are generated once by walking the faces of the cell: on every face the
+/// crossing edges are paired so that the inside corners are kept apart (a
+/// choice that depends on the face only, so neighboring cells agree and the
+/// surface is closed), the pairs are chained into loops around the cell, and
+/// every loop is fanned into triangles facing the outside. A fan must not put
+/// a diagonal on a face of the cell (the neighbor on the other side would not
+/// have it), so every loop is fanned from an edge that shares no face with
+/// the edges it is joined to.
+struct MarchingCubes{
+    int edge_corner[12];
+    signed char triangles[256][16]; ///< edges of the triangles, -1 terminated
+    signed char segment[256][12];   ///< edge that follows on the face walk, -1 if none
+
+    MarchingCubes(){
+        static const int axis_corners[4] = {0,1,2,3}; ///< with the axis bit cleared
+        for(int a=0; a<3; a++)
+            for(int n=0; n<4; n++)
+                edge_corner[4*a+n] = spread(axis_corners[n], a);
+        for(int c=0; c<256; c++)
+            build(c);
+        orient();
+        for(int c=0; c<256; c++)
+            Q_ASSERT(manifold(c));
+    }
+
+    /// Inserts a 0 bit at position "axis" of the 2 bit number n
+    static int spread(int n, int axis){
+        int low = n & ((1<<axis)-1);
+        return ((n>>axis)<<(axis+1)) | low;
+    }
+    int edge(int c0, int c1) const{
+        int axis = (c0^c1)==1 ? 0 : ((c0^c1)==2 ? 1 : 2);
+        int low = std::min(c0, c1);
+        for(int n=0; n<4; n++)
+            if(edge_corner[4*axis+n]==low) return 4*axis+n;
+        return -1;
+    }
+
+    void build(int inside){
+        /// Segments of the surface on the 6 faces, from the edge where the
+        /// walk around the face enters the inside to the one where it leaves
+        int next[12];
+        for(int e=0; e<12; e++) next[e] = -1;
+        for(int axis=0; axis<3; axis++){
+            for(int side=0; side<2; side++){
+                /// Corners of the face, counterclockwise seen from outside
+                int u = (axis+1)%3, v = (axis+2)%3;
+                int c[4] = { 0, 1<<u, (1<<u)|(1<<v), 1<<v };
+                for(int i=0; i<4; i++) c[i] |= side<<axis;
+                if(!side) std::swap(c[1], c[3]);
+
+                /// Crossings alternate between entering and leaving the inside
+                /// along the walk, so with two inside corners facing each other,
+                /// pairing every entry with the crossing that follows it gives
+                /// each corner its own segment
+                int cross[4], n = 0;
+                bool entering[4];
+                for(int i=0; i<4; i++){
+                    bool a = inside>>c[i] & 1, b = inside>>c[(i+1)%4] & 1;
+                    if(a==b) continue;
+                    entering[n] = b;
+                    cross[n++] = edge(c[i], c[(i+1)%4]);
+                }
+                for(int i=0; i<n; i++)
+                    if(entering[i]) next[cross[i]] = cross[(i+1)%n];
+            }
+        }
+        for(int e=0; e<12; e++) segment[inside][e] = next[e];
+
+        /// Chain the segments into loops and fan them
+        int t = 0;
+        bool used[12] = {false};
+        for(int e=0; e<12; e++){
+            if(next[e]<0 || used[e]) continue;
+            std::vector<int> loop;
+            for(int f=e; !used[f]; f=next[f]){
+                used[f] = true;
+                loop.push_back(f);
+            }
+            int n = loop.size(), apex = fan_apex(loop);
+            for(int k=1; k+1<n; k++){
+                triangles[inside][t++] = loop[apex];
+                triangles[inside][t++] = loop[(apex+k)%n];
+                triangles[inside][t++] = loop[(apex+k+1)%n];
+            }
+        }
+        for(; t<16; t++) triangles[inside][t] = -1;
+    }
+
+    /// Do two edges of the cell lie on a common face?
+    bool share_face(int e0, int e1) const{
+        for(int axis=0; axis<3; axis++){
+            if(e0/4==axis || e1/4==axis) continue;
+            if((edge_corner[e0]>>axis & 1) == (edge_corner[e1]>>axis & 1)) return true;
+        }
+        return false;
+    }
+    /// Position in the loop from which all the diagonals of a fan are inside
+    /// the cell (there is one in all 256 cases, see manifold)
+    int fan_apex(const std::vector<int>& loop) const{
+        int n = loop.size();
+        for(int a=0; a<n; a++){
+            bool inner = true;
+            for(int k=2; inner && k+1<n; k++)
+                inner = !share_face(loop[a], loop[(a+k)%n]);
+            if(inner) return a;
+        }
+        return 0;
+    }
+
+    /// Every side of a triangle is either a segment on a face, used once
+    /// (the neighbor uses it once the other way), or a diagonal off the faces
+    /// used once in each direction: every edge of the mesh then has exactly
+    /// two opposite half-edges, away from the unobserved voxels
+    bool manifold(int inside) const{
+        int used[12][12] = {{0}};
+        const signed char* tri = triangles[inside];
+        for(int t=0; t<16 && tri[t]>=0; t+=3)
+            for(int k=0; k<3; k++)
+                used[tri[t+k]][tri[t+(k+1)%3]]++;
+        for(int a=0; a<12; a++){
+            for(int b=0; b<12; b++){
+                bool on_face = segment[inside][a]==b || segment[inside][b]==a;
+                if(used[a][b] > 1) return false;
+                if(on_face && used[a][b]+used[b][a]!=1) return false;
+                if(!on_face && used[a][b] && (used[b][a]!=1 || share_face(a, b))) return false;
+            }
+        }
+        return true;
+    }
+
+    /// The walk orientation above is a convention, check it on a cell with
+    /// only corner 0 inside: the normal must point away from the corner
+    void orient(){
+        const signed char* tri = triangles[1];
+        Eigen::Vector3f p[3];
+        for(int k=0; k<3; k++) p[k] = midpoint(tri[k]);
+        if((p[1]-p[0]).cross(p[2]-p[0]).sum() > 0) return;
+        for(int c=0; c<256; c++)
+            for(int t=0; t<16 && triangles[c][t]>=0; t+=3)
+                std::swap(triangles[c][t+1], triangles[c][t+2]);
+    }
+    Eigen::Vector3f midpoint(int e) const{
+        int c = edge_corner[e];
+        Eigen::Vector3f p(c&1, (c>>1)&1, (c>>2)&1);
+        p[e/4] += .5f;
+        return p;
+    }
+};
+
+static const MarchingCubes& marching_cubes(){
+    static MarchingCubes tables;
+    return tables;
+}
+/// @}
+
+TsdfVolume::Block::Block(const Key& key) : key(key), stamp(-1), dirty(false){
+    for(int i=0; i<BLOCK*BLOCK*BLOCK; i++){
+        voxels[i].sdf = 1;
+        voxels[i].weight = 0;
+    }
+}
+
+TsdfVolume::TsdfVolume(float voxelSize, float truncation, float maxDepth){
+    _voxelSize = voxelSize;
+    _truncation = truncation;
+    _maxDepth = maxDepth;
+    _maxWeight = 64;
+    _stamp = 0;
+    marching_cubes(); ///< builds the tables
+}
+
+TsdfVolume::~TsdfVolume(){
+    reset();
+}
+
+void TsdfVolume::reset(){
+    qDeleteAll(_blocks);
+    _blocks.clear();
+    _touched.clear();
+    _vertices.clear();
+    _vertexEdges.clear();
+    _users.clear();
+    _freeVertices.clear();
+    _welded.clear();
+}
+
+TsdfVolume::Block* TsdfVolume::allocate(const Key& key){
+    Block*& block = _blocks[key];
+    if(!block) block = new Block(key);
+    if(block->stamp != _stamp){
+        block->stamp = _stamp;
+        _touched.push_back(block);
+    }
+    return block;
+}
+
+/// @{ tiles of blocks
+struct IntegrateBlocks{
+    void operator()(int begin, int end) const{
+        for(int i=begin; i<end; i++)
+            volume.integrate(blocks[i], frame);
+    }
+    const TsdfVolume& volume;
+    TsdfVolume::Block* const* blocks;
+    const PointFrame& frame;
+};
+
+struct ExtractBlocks{
+    void operator()(int begin, int end) const{
+        for(int i=begin; i<end; i++)
+            volume.extract(blocks[i]);
+    }
+    const TsdfVolume& volume;
+    TsdfVolume::Block* const* blocks;
+};
+/// @}
+
+void TsdfVolume::integrate(const PointFrame& frame){
+    if(frame.empty() || !frame.xzFactor()) return;
+    _stamp++;
+    _touched.clear();
+
+    /// Blocks around the surface: along the ray of every other pixel, from
+    /// truncation in front of the measured depth to truncation behind it
+    int width = frame.width(), height = frame.height();
+    float block_size = _voxelSize * BLOCK;
+    Key last = {0,0,0};
+    bool has_last = false;
+    for(int y=0; y<height; y+=2){
+        float ny = (.5f - float(y)/height) * frame.yzFactor();
+        for(int x=0; x<width; x+=2){
+            float d = frame.depthAt(y*width+x);
+            if(!d || d>_maxDepth) continue;
+            float nx = (float(x)/width - .5f) * frame.xzFactor();
+            for(int s=-1; s<=1; s++){
+                float z = d + s*_truncation;
+                Key key = { int(std::floor(nx*z/block_size)), int(std::floor(ny*z/block_size)),
+                            int(std::floor(z/block_size)) };
+                if(has_last && key==last) continue;
+                allocate(key);
+                last = key;
+                has_last = true;
+            }
+        }
+    }
+
+    IntegrateBlocks blocks = { *this, _touched.constData(), frame };
+    FrameStage::forEachRowTile(_touched.size(), blocks, 16);
+}
+
+void TsdfVolume::integrate(Block* block, const PointFrame& frame) const{
+    int width = frame.width(), height = frame.height();
+    float xz = frame.xzFactor(), yz = frame.yzFactor();
+    bool changed = false;
+    for(int k=0; k<BLOCK; k++){
+        float z = (block->key.z*BLOCK + k) * _voxelSize;
+        if(z <= 0) continue;
+        for(int j=0; j<BLOCK; j++){
+            float y = (block->key.y*BLOCK + j) * _voxelSize;
+            int v = int(std::floor((.5f - y/(z*yz)) * height + .5f));
+            if(v<0 || v>=height) continue;
+            for(int i=0; i<BLOCK; i++){
+                float x = (block->key.x*BLOCK + i) * _voxelSize;
+                int u = int(std::floor((x/(z*xz) + .5f) * width + .5f));
+                if(u<0 || u>=width) continue;
+                float d = frame.depthAt(v*width+u);
+                if(!d || d>_maxDepth) continue;
+
+                /// Distance along the ray, positive in front of the surface.
+                /// Far behind it is hidden, nothing is known there
+                float sdf = d - z;
+                if(sdf < -_truncation) continue;
+                Voxel& voxel = block->voxels[(k*BLOCK + j)*BLOCK + i];
+                voxel.sdf = (voxel.sdf*voxel.weight + std::min(1.0f, sdf/_truncation)) / (voxel.weight+1);
+                voxel.weight = std::min(voxel.weight+1, _maxWeight);
+                changed = true;
+            }
+        }
+    }
+    if(changed) block->dirty = true;
+}
+
+int TsdfVolume::extract(QVector<Key>* changed){
+    /// Cells read the voxels of the blocks after them, so a changed block
+    /// also changes the meshes of the blocks before it
+    QVector<Block*> dirty;
+    foreach(Block* block, _blocks)
+        if(block->dirty) dirty.push_back(block);
+    int modified = dirty.size();
+    for(int i=0; i<modified; i++){
+        for(int n=1; n<8; n++){
+            Key key = { dirty[i]->key.x-(n&1), dirty[i]->key.y-((n>>1)&1), dirty[i]->key.z-((n>>2)&1) };
+            Block* neighbor = _blocks.value(key, NULL);
+            if(neighbor && !neighbor->dirty){
+                neighbor->dirty = true;
+                dirty.push_back(neighbor);
+            }
+        }
+    }
+
+    ExtractBlocks blocks = { *this, dirty.constData() };
+    FrameStage::forEachRowTile(dirty.size(), blocks, 16);
+    foreach(Block* block, dirty){
+        weld(block);
+        block->dirty = false;
+        if(changed) changed->push_back(block->key);
+    }
+    return dirty.size();
+}
+
+void TsdfVolume::weld(Block* block){
+    std::vector<int> welded(block->vertices.size());
+    for(size_t v=0; v<block->vertices.size(); v++){
+        int& index = _welded[block->edges[v]];
+        if(!index){
+            if(_freeVertices.empty()){
+                _vertices.push_back(Eigen::Vector3f());
+                _vertexEdges.push_back(0);
+                _users.push_back(0);
+                index = _vertices.size(); ///< +1, 0 is "not welded yet"
+            } else {
+                index = _freeVertices.back() + 1;
+                _freeVertices.pop_back();
+            }
+            _vertexEdges[index-1] = block->edges[v];
+        }
+        welded[v] = index-1;
+        _users[index-1]++;
+        /// The crossing moves with the voxels of either side
+        _vertices[index-1] = block->vertices[v];
+    }
+
+    /// Then let go of the previous ones (those it still uses stay, they were
+    /// just taken again)
+    for(size_t v=0; v<block->welded.size(); v++){
+        int index = block->welded[v];
+        if(--_users[index]) continue;
+        _welded.remove(_vertexEdges[index]);
+        _freeVertices.push_back(index);
+    }
+    block->welded.swap(welded);
+}
+
+void TsdfVolume::triangles(const Key& key, std::vector<int>& triangles) const{
+    triangles.clear();
+    const Block* block = _blocks.value(key, NULL);
+    if(!block) return;
+    triangles.reserve(block->triangles.size());
+    for(size_t t=0; t<block->triangles.size(); t++)
+        triangles.push_back(block->welded[block->triangles[t]]);
+}
+
+void TsdfVolume::extract(Block* block) const{
+    const MarchingCubes& mc = marching_cubes();
+    block->vertices.clear();
+    block->edges.clear();
+    block->triangles.clear();
+
+    /// The block and the 7 after it, cells at the far sides reach into them
+    const Block* around[8];
+    for(int n=0; n<8; n++){
+        Key key = { block->key.x+(n&1), block->key.y+((n>>1)&1), block->key.z+((n>>2)&1) };
+        around[n] = n ? _blocks.value(key, NULL) : block;
+    }
+
+    /// Vertex on the edge starting at (i,j,k) of the block along an axis, -1 if none yet
+    enum{ SIDE = BLOCK+1 };
+    std::vector<int> vertex(SIDE*SIDE*SIDE*3, -1);
+
+    for(int k=0; k<BLOCK; k++){
+        for(int j=0; j<BLOCK; j++){
+            for(int i=0; i<BLOCK; i++){
+                /// Corners of the cell
+                const Voxel* corner[8];
+                bool observed = true;
+                int inside = 0;
+                for(int c=0; c<8 && observed; c++){
+                    int ci = i+(c&1), cj = j+((c>>1)&1), ck = k+((c>>2)&1);
+                    int n = (ci/BLOCK) | ((cj/BLOCK)<<1) | ((ck/BLOCK)<<2);
+                    if(!around[n]){ observed = false; break; }
+                    corner[c] = &around[n]->voxels[((ck%BLOCK)*BLOCK + cj%BLOCK)*BLOCK + ci%BLOCK];
+                    if(corner[c]->weight==0) observed = false;
+                    if(corner[c]->sdf < 0) inside |= 1<<c;
+                }
+                if(!observed || inside==0 || inside==255) continue;
+
+                for(int t=0; t<16 && mc.triangles[inside][t]>=0; t++){
+                    int e = mc.triangles[inside][t];
+                    int c0 = mc.edge_corner[e], axis = e/4, c1 = c0 | (1<<axis);
+                    int ei = i+(c0&1), ej = j+((c0>>1)&1), ek = k+((c0>>2)&1);
+                    int& index = vertex[((ek*SIDE + ej)*SIDE + ei)*3 + axis];
+                    if(index<0){
+                        /// Zero crossing between the two corners
+                        float s0 = corner[c0]->sdf, s1 = corner[c1]->sdf;
+                        /// Kept off the corners: vertices of other edges would
+                        /// land on the same point, with triangles of no area
+                        float f = std::min(std::max(s0 / (s0 - s1), 1e-3f), 1 - 1e-3f);
+                        int g[3] = { block->key.x*BLOCK + ei, block->key.y*BLOCK + ej, block->key.z*BLOCK + ek };
+                        Eigen::Vector3f p(g[0], g[1], g[2]);
+                        p[axis] += f;
+                        index = block->vertices.size();
+                        block->vertices.push_back(p * _voxelSize);
+                        /// Global id of the edge: 20 bits per coordinate, 2 for the axis
+                        qint64 id = 0;
+                        for(int a=2; a>=0; a--)
+                            id = (id<<20) | ((g[a] + (1<<19)) & 0xFFFFF);
+                        block->edges.push_back((id<<2) | axis);
+                    }
+                    block->triangles.push_back(index);
+                }
+            }
+        }
+    }
+}
+
+void TsdfVolume::mesh(std::vector<Eigen::Vector3f>& vertices, std::vector<int>& triangles) const{
+    vertices.clear();
+    triangles.clear();
+    /// Only the used slots of _vertices, in order
+    std::vector<int> remap(_vertices.size(), -1);
+    for(size_t v=0; v<_vertices.size(); v++){
+        if(!_users[v]) continue;
+        remap[v] = vertices.size();
+        vertices.push_back(_vertices[v]);
+    }
+    /// Every triangle is kept, dropping one would open the surface
+    foreach(const Block* block, _blocks)
+        for(size_t t=0; t<block->triangles.size(); t++)
+            triangles.push_back(remap[block->welded[block->triangles[t]]]);
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <vector>
+#include <QHash>
+#include <QVector>
+#include <Eigen/Core>
+#include "PointFrame.h"
+
+/// Truncated signed distance volume, into which depth frames are fused (as in
+/// KinectFusion). It is stored sparsely: only the blocks of 8^3 voxels close
+/// to an observed surface are allocated, and they are found through a hash of
+/// their coordinates, so memory grows with the observed surface and not with
+/// the volume it spans. The blocks a frame touches are updated in parallel,
+/// and only the blocks whose voxels changed are triangulated again (marching
+/// cubes), each into a mesh of its own. The vertices the blocks share are
+/// welded as the blocks are triangulated, into one array of vertices that
+/// the triangles of every block index, so that a mesh of the surface can be
+/// kept up to date block by block (see FusionStage).
+/// @note integrate(), extract() and mesh() from one thread at a time
+class TsdfVolume{
+public:
+    enum{ BLOCK = 8 }; ///< voxels per side of a block
+
+    /// voxelSize, truncation and maxDepth in mm (the unit of PointFrame)
+    TsdfVolume(float voxelSize=10, float truncation=40, float maxDepth=3500);
+    ~TsdfVolume();
+    /// Forgets everything that was fused
+    void reset();
+
+    /// Fuses the depth of a frame, seen from the origin (the sensor is fixed)
+    void integrate(const PointFrame& frame);
+    /// Integer coordinates of a block (in blocks)
+    struct Key{
+        int x, y, z;
+        bool operator==(const Key& k) const { return x==k.x && y==k.y && z==k.z; }
+    };
+
+    /// Triangulates the blocks that changed since the last call, returns how
+    /// many. Their keys are appended to "changed" if given
+    int extract(QVector<Key>* changed=NULL);
+    /// All the triangles, with the vertices shared by neighboring blocks welded
+    void mesh(std::vector<Eigen::Vector3f>& vertices, std::vector<int>& triangles) const;
+
+    /// @{ the surface block by block, as of the last extract()
+    /// Welded vertices of all the blocks. The slots of vertices no triangle
+    /// uses any more are given to the next new ones
+    const std::vector<Eigen::Vector3f>& vertices() const { return _vertices; }
+    /// Triangles of a block, as indices into vertices() (none if no such block)
+    void triangles(const Key& key, std::vector<int>& triangles) const;
+    /// Keys of all the blocks
+    QList<Key> blocks() const { return _blocks.keys(); }
+    /// @}
+
+    float voxelSize() const { return _voxelSize; }
+    int blockCount() const { return _blocks.size(); }
+    /// Bytes used by the voxels
+    qint64 memory() const { return qint64(_blocks.size()) * sizeof(Block); }
+
+private:
+    struct Voxel{
+        float sdf;    ///< signed distance / truncation, negative behind the surface
+        float weight; ///< 0 if never observed
+    };
+    struct Block{
+        Block(const Key& key);
+        Voxel voxels[BLOCK*BLOCK*BLOCK]; ///< x fastest
+        Key key;
+        int stamp;  ///< last integration that touched the block
+        bool dirty; ///< changed since its mesh was extracted
+        /// @{ mesh of the cells whose lowest corner is in the block
+        std::vector<Eigen::Vector3f> vertices;
+        std::vector<qint64> edges; ///< of the grid each vertex is on, for welding
+        std::vector<int> triangles;
+        /// @}
+        std::vector<int> welded; ///< index in _vertices of each vertex
+    };
+    friend struct IntegrateBlocks;
+    friend struct ExtractBlocks;
+    Block* allocate(const Key& key);
+    void integrate(Block* block, const PointFrame& frame) const;
+    void extract(Block* block) const;
+    /// Moves the vertices of a block that was just extracted into _vertices
+    void weld(Block* block);
+
+    float _voxelSize;
+    float _truncation;
+    float _maxDepth;
+    float _maxWeight;   ///< older observations fade out past this many frames
+    int _stamp;         ///< integrations so far
+    QHash<Key, Block*> _blocks;
+    QVector<Block*> _touched; ///< by the current integration
+
+    /// @{ welded vertices
+    std::vector<Eigen::Vector3f> _vertices;
+    std::vector<qint64> _vertexEdges; ///< edge of the grid of each vertex
+    std::vector<int> _users;          ///< blocks using each vertex, 0 if the slot is free
+    std::vector<int> _freeVertices;   ///< slots with no users
+    QHash<qint64, int> _welded;       ///< edge of the grid -> vertex
+    /// @}
+};
+
+inline uint qHash(const TsdfVolume::Key& key){
+    return uint(key.x)*73856093u ^ uint(key.y)*19349663u ^ uint(key.z)*83492791u;
+}
@@ -0,0 +1,24 @@
+include($$[STARLAB])
+include($$[OPENNI])
+StarlabTemplate(console)
+
+TARGET = kinect_benchmark
+QT += opengl
+
+INCLUDEPATH += ..
+HEADERS += ../KinectHelper.h \
+    ../FramePipeline.h
+SOURCES += kinect_benchmark.cpp \
+    ../KinectHelper.cpp \
+    ../DepthUnprojector.cpp \
+    ../DepthKernels.cpp \
+    ../DepthFilter.cpp \
+    ../NormalEstimator.cpp \
+    ../FrameSynchronizer.cpp \
+    ../RawFrameFile.cpp \
+    ../FrameRecorder.cpp \
+    ../KinectProfiler.cpp \
+    ../FramePipeline.cpp \
+    ../DecimationStage.cpp \
+    ../CloudRenderer.cpp \
+    ../GpuCloudRenderer.cpp
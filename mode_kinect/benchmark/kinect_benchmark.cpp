@@ -0,0 +1,276 @@
+/// Throughput and latency of the Kinect processing path, without a sensor.
+/// Frames come from a .kraw recording (see KinectHelper::startRecording) or
+/// are synthesized, and go through the stages of KinectHelper one at a time:
+///   consume (KinectHelper::deliver_raw, as when playing the recording: 
+///   consume_depth, the color hand-off and the publication), work (a 
+///   FramePipeline stage) and drawCloud (into an offscreen pixel buffer)
+/// The parts of consume come from the KinectProfiler records of the run
+/// (consume_depth is its "unproject" event, consume_color its "color" one).
+/// Results are written as JSON, so that builds can be compared. On machines
+/// without a display run it through xvfb-run (Mesa's llvmpipe is enough).
+///
+/// usage: kinect_benchmark [--frames N] [--source file.kraw] [--compress] [--gpu] [--denoise] [--normals] [--no-draw] [--json out.json]
+/// (--compress: synthesize with compressed depth, deliver then includes its decoding)
+#include <QApplication>
+#include <QGLPixelBuffer>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QStringList>
+#include <QTextStream>
+#include <QFile>
+#include <QMap>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include "KinectHelper.h"
+#include "FramePipeline.h"
+#include "DecimationStage.h"
+
+/// @{ every allocation of the process is counted, in 64 bits (a frame may
+/// allocate more than 2GB), behind a spin lock since a QMutex would itself
+/// allocate from within operator new
+static QBasicAtomicInt allocated_lock = Q_BASIC_ATOMIC_INITIALIZER(0);
+static qint64 allocated_bytes = 0;
+static qint64 allocated(qint64 add, bool reset=false){
+    while(!allocated_lock.testAndSetAcquire(0, 1)) {}
+    qint64 bytes = allocated_bytes += add;
+    if(reset) allocated_bytes = 0;
+    allocated_lock.fetchAndStoreRelease(0);
+    return bytes;
+}
+void* operator new(size_t size){
+    allocated(qint64(size));
+    void* p = std::malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size){ return operator new(size); }
+void operator delete(void* p) throw(){ std::free(p); }
+void operator delete[](void* p) throw(){ std::free(p); }
+/// @}
+
+/// Writes "count" frames of a ball moving in front of a wall, with holes
+static bool synthesize(const QString& path, int count, bool compress){
+    const int width = 640, height = 480;
+    RawFrameWriter writer;
+    /// Field of view of the Kinect depth camera
+    if(!writer.open(path, width, height, width, height, 1.0144f, 0.7898f,
+                    compress ? RawFrameFile::DEPTH_DELTA : RawFrameFile::DEPTH_RAW))
+        return false;
+    std::vector<openni::DepthPixel> depth(width*height);
+    std::vector<uchar> color(3*width*height);
+    for(int f=0; f<count; f++){
+        int cx = width/2 + int(150*std::sin(0.1*f)), cy = height/2, r = 80;
+        for(int y=0; y<height; y++){
+            for(int x=0; x<width; x++){
+                int i = y*width+x;
+                int dx = x-cx, dy = y-cy;
+                bool ball = dx*dx+dy*dy < r*r;
+                bool hole = ((x/16 + y/16 + f) % 11) == 0;
+                depth[i] = hole ? 0 : (ball ? 1200 : 2500 + (x % 64));
+                color[3*i+0] = ball ? 255 : x*255/width;
+                color[3*i+1] = y*255/height;
+                color[3*i+2] = f % 256;
+            }
+        }
+        writer.write(33333ull*f, f, &depth[0], &color[0]);
+    }
+    writer.close();
+    return true;
+}
+
+/// Same work as the example stage of mode_kinect: visit every valid point
+class ScanStage : public FrameStage{
+public:
+    ScanStage() : visited(0){}
+    QString name() const { return "Scan"; }
+    struct Rows{
+        Rows(const PointFrame& points, QAtomicInt& visited) : points(points), visited(visited){}
+        void operator()(int begin, int end) const{
+            int n = 0;
+            for(int y=begin; y<end; ++y)
+                for(int x=0; x<points.width(); ++x)
+                    if(points.isValid(x,y)) n++;
+            visited.fetchAndAddRelaxed(n);
+        }
+        const PointFrame& points;
+        QAtomicInt& visited;
+    };
+    void process(FrameJob& job){
+        if(!job.frame.points.unprojected()) return;
+        forEachRowTile(job.frame.points.height(), Rows(job.frame.points, visited));
+    }
+    QAtomicInt visited;
+};
+
+/// Drives the private stages of KinectHelper (it is a friend)
+class KinectBenchmark{
+public:
+    typedef QMap<QString, std::vector<double> > Samples; ///< microseconds per stage
+
+    KinectBenchmark(KinectHelper* helper) : helper(helper){}
+    /// Frames in the recording
+    int count() const { return helper->raw_source->count(); }
+    /// Is the depth of the recording compressed?
+    bool compressed() const { return helper->raw_source->header().compression != RawFrameFile::DEPTH_RAW; }
+    /// Flavour of the unprojection kernel
+    const char* kernel() const { return helper->unprojector.kernels.name(); }
+    /// What the profiler recorded for the sensor over the last "window" ns
+    QVariantMap profile(qint64 window) const { return KinectProfiler::instance().statistics(helper->sensorId(), window); }
+
+    /// Runs frame i of the recording through all the stages
+    void frame(int i, FramePipeline& pipeline, QGLPixelBuffer* pbuffer){
+        QElapsedTimer timer;
+
+        /// What consume() does for the frame of a recording that is due
+        timer.start();
+        helper->deliver_raw(i);
+        sample("consume", timer);
+
+        /// What mode_kinect::work() does, waiting for the pipeline to finish
+        {
+            KinectHelper::FrameReader reader(helper->frames());
+            pipeline.submit(*reader);
+        }
+        pipeline.waitForDone();
+        sample("work", timer);
+
+        if(pbuffer){
+            pbuffer->makeCurrent();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            helper->drawCloud();
+            glFinish();
+            sample("drawCloud", timer);
+        }
+    }
+
+    Samples samples;
+private:
+    void sample(const char* stage, QElapsedTimer& timer){
+        samples[stage].push_back(timer.nsecsElapsed() / 1000.0);
+        timer.restart();
+    }
+    KinectHelper* helper;
+};
+
+static double percentile(std::vector<double> values, double p){
+    if(values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size()-1, size_t(p*values.size()))];
+}
+
+int main(int argc, char** argv){
+    QApplication app(argc, argv);
+    QStringList args = app.arguments();
+    int frames = 300;
+    QString source, json;
+    bool gpu = false, draw = true, denoise = false, normals = false, compress = false;
+    for(int i=1; i<args.size(); i++){
+        if(args[i]=="--frames" && i+1<args.size()) frames = args[++i].toInt();
+        else if(args[i]=="--source" && i+1<args.size()) source = args[++i];
+        else if(args[i]=="--json" && i+1<args.size()) json = args[++i];
+        else if(args[i]=="--compress") compress = true;
+        else if(args[i]=="--gpu") gpu = true;
+        else if(args[i]=="--denoise") denoise = true;
+        else if(args[i]=="--normals") normals = true;
+        else if(args[i]=="--no-draw") draw = false;
+        else { QTextStream(stderr) << "usage: kinect_benchmark [--frames N] [--source file.kraw] [--compress] [--gpu] [--denoise] [--normals] [--no-draw] [--json out.json]\n"; return 1; }
+    }
+
+    /// Synthetic frames unless a recording was given
+    QString synthetic;
+    if(source.isEmpty()){
+        synthetic = QString("%1/kinect_benchmark_%2.kraw").arg(QDir::tempPath()).arg(app.applicationPid());
+        if(!synthesize(synthetic, qMin(frames, 60), compress)) return 1;
+        source = synthetic;
+    }
+
+    KinectHelper* helper = new KinectHelper(0, source);
+    if(!helper->open()){ QTextStream(stderr) << "cannot open " << source << "\n"; return 1; }
+    helper->setGpuUnprojection(gpu);
+    helper->setNormalEstimation(normals);
+    if(denoise){
+        DepthFilter::Parameters filter;
+        filter.temporal = filter.spatial = true;
+        helper->depthFilter().setParameters(filter);
+    }
+    KinectBenchmark benchmark(helper);
+    FramePipeline pipeline;
+    pipeline.addStage(new DecimationStage());
+    pipeline.addStage(new ScanStage());
+
+    /// Offscreen GL context for drawCloud
+    QGLPixelBuffer* pbuffer = NULL;
+    if(draw && QGLPixelBuffer::hasOpenGLPbuffers()){
+        pbuffer = new QGLPixelBuffer(QSize(640,480));
+        pbuffer->makeCurrent();
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        glFrustum(-0.5, 0.5, -0.375, 0.375, 1, 10000);
+        glMatrixMode(GL_MODELVIEW);
+        glLoadIdentity();
+        glScalef(1, 1, -1);
+    } else if(draw){
+        QTextStream(stderr) << "no pixel buffers, drawCloud is not measured\n";
+    }
+
+    /// Recordings loop until enough frames went through
+    int count = benchmark.count();
+    std::vector<double> allocations;
+    QElapsedTimer total;
+    total.start();
+    for(int i=0; i<frames; i++){
+        allocated(0, true);
+        benchmark.frame(i % count, pipeline, pbuffer);
+        allocations.push_back(double(allocated(0, true)));
+    }
+    double seconds = total.nsecsElapsed() / 1e9;
+    /// Only the records of the run (the profiler keeps the last few
+    /// thousand events of every thread)
+    QVariantMap profile = benchmark.profile(total.nsecsElapsed());
+
+    /// Report
+    QFile file(json);
+    bool opened = json.isEmpty() ? file.open(stdout, QIODevice::WriteOnly) : file.open(QIODevice::WriteOnly);
+    if(!opened){ QTextStream(stderr) << "cannot write " << json << "\n"; return 1; }
+    QTextStream out(&file);
+    out << "{\n";
+    out << "  \"frames\": " << frames << ",\n";
+    out << "  \"kernel\": \"" << benchmark.kernel() << "\",\n";
+    out << "  \"compressed\": " << (benchmark.compressed() ? "true" : "false") << ",\n";
+    out << "  \"gpu_unprojection\": " << (gpu ? "true" : "false") << ",\n";
+    out << "  \"denoise\": " << (denoise ? "true" : "false") << ",\n";
+    out << "  \"normals\": " << (normals ? "true" : "false") << ",\n";
+    out << "  \"fps\": " << frames/seconds << ",\n";
+    out << "  \"bytes_allocated_per_frame\": " << qint64(percentile(allocations, 0.5)) << ",\n";
+    out << "  \"stages\": {";
+    bool first = true;
+    foreach(QString stage, benchmark.samples.keys()){
+        const std::vector<double>& values = benchmark.samples[stage];
+        out << (first ? "\n" : ",\n");
+        out << "    \"" << stage << "\": { \"p50_us\": " << percentile(values, 0.5)
+            << ", \"p99_us\": " << percentile(values, 0.99) << " }";
+        first = false;
+    }
+    out << "\n  },\n";
+    /// Breakdown of consume, named after the methods, and the other events
+    const char* parts[][2] = { {"consume", "consume"}, {"consume_depth", "unproject"}, {"filter", "filter"},
+                               {"normals", "normals"}, {"consume_color", "color"}, {"swap", "swap"},
+                               {"work", "work"}, {"draw", "draw"}, {"lock_wait", "lock_wait"} };
+    out << "  \"profiler\": {";
+    for(size_t i=0; i<sizeof(parts)/sizeof(parts[0]); i++){
+        QString event = parts[i][1];
+        out << (i ? ",\n" : "\n");
+        out << "    \"" << parts[i][0] << "\": { \"count\": " << profile[event+"_count"].toInt()
+            << ", \"mean_us\": " << profile[event+"_mean_us"].toDouble()
+            << ", \"p99_us\": " << profile[event+"_p99_us"].toDouble() << " }";
+    }
+    out << "\n  }\n}\n";
+    out.flush();
+
+    delete pbuffer;
+    helper->destroy();
+    if(!synthetic.isEmpty()) QFile::remove(synthetic);
+    return 0;
+}
@@ -2,27 +2,167 @@
 Q_EXPORT_PLUGIN(mode_kinect)
 
 #include "KinectHelper.h"
+#include "FramePipeline.h"
+#include "DecimationStage.h"
+#include "FusionStage.h"
+#include "DepthFilterWidget.h"
+#include <QGroupBox>
+#include <QCheckBox>
+#include <QPushButton>
+#include <QHBoxLayout>
+#include <QThreadPool>
 
 const int FPS = 60;
 
+/// Template of a processing stage, fill in the blanks
+class ExampleStage : public FrameStage{
+    QString name() const { return "Example"; }
+    
+    /// Processes a band of rows, many bands run in parallel
+    struct Rows{
+        Rows(FrameJob& job) : job(job){}
+        void operator()(int begin, int end) const{
+            /// Process the POINTS (row-major, skip pixels without depth)
+            /// @note with GPU unprojection only the raw depth is available here
+            /// (use a coarser level, e.g. job.points(2), to process fewer points)
+            const PointFrame& points = job.points();
+            if(!points.unprojected()) return;
+            for(int y=begin; y<end; ++y){
+                for(int x = 0; x<points.width(); ++x){
+                    if(!points.isValid(x,y)) continue;
+                    points.point(x,y);
+                    /*..... DO SOMETHING ....*/
+                }
+            }
+        }
+        FrameJob& job;
+    };
+    
+    void process(FrameJob& job){
+        forEachRowTile(job.points().height(), Rows(job));
+        /// Results for decorate() or the following stages
+        // job.results["example"] = ...;
+    }
+    
+    void decorate(const FrameJob& job){
+        Q_UNUSED(job);
+        /*..... DRAW SOMETHING ....*/
+    }
+};
+
+mode_kinect::mode_kinect(){
+    khelper = NULL;
+    k_thread = NULL;
+    acquisition = NULL;
+    pipeline = NULL;
+    fusion = NULL;
+    kstatistics = NULL;
+    statistics_timer = NULL;
+    timer = NULL;
+}
+
+mode_kinect::~mode_kinect(){
+    if(!khelper) return;
+    /// destroy() deletes the helper, in its own thread (after the tasks it
+    /// still had in the pool)
+    foreach(KinectHelper* sensor, sensors){
+        if(k_thread)
+            QMetaObject::invokeMethod(sensor, "destroy", Qt::BlockingQueuedConnection);
+        else
+            sensor->destroy();
+    }
+    if(k_thread){
+        k_thread->quit();
+        k_thread->wait();
+        delete k_thread;
+    }
+    delete acquisition;
+}
+
+void mode_kinect::create_kinect(){
+    /// create kinect & workers. Set KINECT_SOURCE to an .oni or .kraw file to
+    /// play a recording instead, to several devices (URIs) or recordings 
+    /// separated by ';' to open them together, or to "all" to open every
+    /// device plugged in. KINECT_PLAYBACK chooses how recordings are played:
+    /// "fastest", "realtime" or "step"
+    QString source = QString::fromLocal8Bit(qgetenv("KINECT_SOURCE"));
+    QStringList uris = source.split(';', QString::SkipEmptyParts);
+    if(source=="all") uris = KinectHelper::connectedDevices();
+    if(uris.isEmpty()) uris << QString(); ///< the default device
+    QByteArray playback = qgetenv("KINECT_PLAYBACK");
+    
+#define ENABLE_KINECT_THREAD
+#ifdef ENABLE_KINECT_THREAD
+    /// One thread drives all the sensors, their per-frame work (filtering,
+    /// unprojection, recording) goes to a pool sized to the cores
+    k_thread = new QThread();
+    acquisition = new QThreadPool();
+#endif
+
+    foreach(QString uri, uris){
+        KinectHelper* sensor = new KinectHelper(0, uri);
+        if(playback=="fastest") sensor->setPlaybackMode(KinectHelper::PLAYBACK_FASTEST);
+        if(playback=="step")    sensor->setPlaybackMode(KinectHelper::PLAYBACK_STEP);
+    
+/// Unproject in the vertex shader instead of the kinect thread
+// #define ENABLE_GPU_UNPROJECTION
+#ifdef ENABLE_GPU_UNPROJECTION
+        sensor->setGpuUnprojection(true);
+#endif
+
+/// Estimate normals (lit points), about a core at 30Hz
+// #define ENABLE_NORMALS
+#ifdef ENABLE_NORMALS
+        sensor->setNormalEstimation(true);
+#endif
+    
+        /// Follow the initialization, which happens in the kinect thread
+        connect(sensor, SIGNAL(progress(QString)), mainWindow()->statusBar(), SLOT(showMessage(QString)));
+        connect(sensor, SIGNAL(failed(QString)), mainWindow()->statusBar(), SLOT(showMessage(QString)));
+        connect(sensor, SIGNAL(scene_bbox_updated(BBox3)), this, SLOT(fitScene(BBox3)));
+        connect(sensor, SIGNAL(opened()), sensor, SLOT(start()));
+    
+        if(k_thread){
+            sensor->moveToThread(k_thread);
+            sensor->setThreadPool(acquisition);
+        }
+        sensors.push_back(sensor);
+    }
+    khelper = sensors.first();
+    
+    if(k_thread) k_thread->start();
+    foreach(KinectHelper* sensor, sensors)
+        QMetaObject::invokeMethod(sensor, "open", Qt::QueuedConnection);
+    
+    /// Per-frame processing of the primary sensor, outside of the GUI thread
+    pipeline = new FramePipeline(this);
+    pipeline->addStage(new DecimationStage());
+    fusion = new FusionStage();
+    pipeline->addStage(fusion);
+    pipeline->addStage(new ExampleStage());
+    
+    /// Timings, for as long as the plugin lives: the Python console may ask
+    /// for them while the mode is not active
+    kstatistics = new KinectStatistics(sensors, pipeline, this);
+    statistics_timer = new QTimer(kstatistics);
+    statistics_timer->setInterval(500);
+    connect(statistics_timer, SIGNAL(timeout()), kstatistics, SLOT(refresh()));
+}
+
 void mode_kinect::create(){   
     // qDebug() << "mode_kinect::create()" << QThread::currentThreadId();
     
-    /// create kinect & workers
-    khelper = new KinectHelper();  
-    connect( parent, SIGNAL(destroyed()), khelper, SLOT(deleteLater()) );
+    /// The device outlives the mode: opening it takes seconds, while
+    /// resuming it takes milliseconds (see destroy)
+    if(!khelper)
+        create_kinect();
+    else
+        foreach(KinectHelper* sensor, sensors)
+            QMetaObject::invokeMethod(sensor, "resume");
     
-    /// Setup viewer BBOX
-    /// @todo match exactly the perspective projection of the kinect
-    BBox3 bbox = khelper->bbox();
-    Vector3 minbound = bbox.min();
-    Vector3 maxbound = bbox.max();
-    qglviewer::Vec min_bound(minbound.x(),minbound.y(),minbound.z());
-    qglviewer::Vec max_bound(maxbound.x(),maxbound.y(),maxbound.z());
-    drawArea()->camera()->fitBoundingBox( min_bound, max_bound );
-    drawArea()->camera()->setSceneRadius((max_bound - min_bound).norm() * 0.4);
-    drawArea()->camera()->setSceneCenter((min_bound + max_bound) * 0.5);
-    drawArea()->camera()->showEntireScene();    
+    /// Setup viewer BBOX (again whenever the scene changes)
+    if(khelper->isOpen())
+        fitScene(khelper->bbox());
     
     /// create a dockwidget to display the color/depth frames
     ModePluginDockWidget* dockwidget = new ModePluginDockWidget("Kinect Widget",mainWindow(),parent);
@@ -32,19 +172,35 @@ void mode_kinect::create(){
     mainWindow()->addDockWidget(Qt::RightDockWidgetArea,dockwidget);
     dockwidget->hide(); /// (will be raised when data arrives)
 
+    /// Denoising of the depth, before unprojection
+    dockwidget->addWidget(new DepthFilterWidget(&khelper->depthFilter()));
+
+    /// Scanning into a mesh (the sensor must stay still)
+    QGroupBox* fusionBox = new QGroupBox("Fusion");
+    QCheckBox* fusionCheck = new QCheckBox("Fuse into a mesh", fusionBox);
+    fusionCheck->setChecked(fusion->model()!=NULL);
+    QPushButton* fusionReset = new QPushButton("Reset", fusionBox);
+    QHBoxLayout* fusionLayout = new QHBoxLayout(fusionBox);
+    fusionLayout->addWidget(fusionCheck);
+    fusionLayout->addWidget(fusionReset);
+    connect(fusionCheck, SIGNAL(toggled(bool)), this, SLOT(toggleFusion(bool)));
+    connect(fusionReset, SIGNAL(clicked()), this, SLOT(resetFusion()));
+    dockwidget->addWidget(fusionBox);
+
     /// hook widgets to kinect
     khelper->setColorLabel(colorLabel);
     khelper->setWidget(dockwidget);
     
-#define ENABLE_KINECT_THREAD
-#ifdef ENABLE_KINECT_THREAD
-    QThread* k_thread = new QThread(khelper);
-    khelper->moveToThread(k_thread);
-    k_thread->start();
-#endif
+    /// Live timings in the dock widget (twice per second), also reachable
+    /// from the Python console through the name of the statistics object
+    QLabel* statisticsLabel = new QLabel();
+    statisticsLabel->setFont(QFont("Monospace", 8));
+    dockwidget->addWidget(statisticsLabel);
+    connect(kstatistics, SIGNAL(reportChanged(QString)), statisticsLabel, SLOT(setText(QString)));
+    statistics_timer->start();
     
-    /// Creates constant framerate events
-    QTimer* timer = new QTimer(this);
+    /// Creates constant framerate events (for as long as the mode is active)
+    timer = new QTimer(parent);
     timer->setSingleShot(false);
     timer->setInterval((1.0/FPS)*1000.0); 
     
@@ -52,33 +208,73 @@ void mode_kinect::create(){
     connect(timer, SIGNAL(timeout()), this, SLOT(work()) );
     connect(timer, SIGNAL(timeout()), drawArea(), SLOT(updateGL()) );
    
-    /// start fetching stuff from kinect & the refresh timer
+    /// start the refresh timer, frames flow as soon as the device is open
     timer->start();
-    khelper->start();
 }
 
-void mode_kinect::work(){
-    QMutexLocker locker(khelper->mutex());       
+void mode_kinect::destroy(){
+    /// Keep the streams warm for the next create()
+    foreach(KinectHelper* sensor, sensors)
+        QMetaObject::invokeMethod(sensor, "suspend");
+    khelper->setColorLabel(NULL);
+    khelper->setWidget(NULL);
+    statistics_timer->stop(); ///< the label goes with the dock widget
+    timer = NULL; ///< deleted with parent
+}
 
-    /// Now process the RGB buffer
-    rgb = khelper->colorBuffer();
-    for (int w = 0; w<rgb.width(); ++w){
-        for(int h = 0; h<rgb.height(); ++h){
-            // rgb.pixel(w,h);
-            rgb.setPixel(w,h, 0);
+void mode_kinect::suspend(){
+    foreach(KinectHelper* sensor, sensors)
+        QMetaObject::invokeMethod(sensor, "suspend");
+    if(timer) timer->stop();
+}
 
-            /*..... DO SOMETHING ....*/
-        }
-    }
-    
-    /// Now process the POINTS buffer
-    KinectHelper::PImage& points = khelper->pointBuffer();                
-    for (int y = 0; y<points.cols(); ++y){
-        for(int x = 0; x<points.rows(); ++x){
-            points(x,y);
-            /*..... DO SOMETHING ....*/                
-        }
+void mode_kinect::resume(){
+    foreach(KinectHelper* sensor, sensors)
+        QMetaObject::invokeMethod(sensor, "resume");
+    if(timer) timer->start();
+}
+
+void mode_kinect::fitScene(BBox3 bbox){
+    /// Every sensor in view, not only the one whose box changed
+    foreach(KinectHelper* sensor, sensors)
+        bbox.extend(sensor->bbox());
+    if(bbox.isNull()) return; ///< no depth yet
+    /// @todo match exactly the perspective projection of the kinect
+    Vector3 minbound = bbox.min();
+    Vector3 maxbound = bbox.max();
+    qglviewer::Vec min_bound(minbound.x(),minbound.y(),minbound.z());
+    qglviewer::Vec max_bound(maxbound.x(),maxbound.y(),maxbound.z());
+    drawArea()->camera()->fitBoundingBox( min_bound, max_bound );
+    drawArea()->camera()->setSceneRadius((max_bound - min_bound).norm() * 0.4);
+    drawArea()->camera()->setSceneCenter((min_bound + max_bound) * 0.5);
+    drawArea()->camera()->showEntireScene();    
+}
+
+void mode_kinect::toggleFusion(bool enabled){
+    if(!enabled){
+        fusion->setModel(NULL);
+        return;
     }
+    /// A new model every time, the previous one stays in the document
+    SurfaceMeshModel* model = new SurfaceMeshModel("", "Kinect Scan");
+    document()->addModel(model);
+    fusion->reset();
+    fusion->setModel(model);
+}
+
+void mode_kinect::resetFusion(){
+    fusion->reset();
+}
+
+void mode_kinect::work(){
+    /// Snapshot of the latest frame, the kinect thread keeps going meanwhile
+    KinectHelper::FrameReader frame(khelper->frames());
+    if(!frame.isNew()) return;
+
+    /// The stages process it in the worker threads of the pipeline (only the
+    /// primary sensor goes through it, the fused mesh is placed by its pose)
+    fusion->setPose(khelper->extrinsic());
+    pipeline->submit(*frame);
 
 //    drawArea()->updateGL();
 //    QApplication::processEvents();
@@ -87,7 +283,50 @@ void mode_kinect::work(){
 void mode_kinect::decorate(){
     /// These will be executed in the main GUI thread! If you have to 
     /// do something special simply define your local function
-    QMutexLocker locker(khelper->mutex());
-    khelper->drawCloud();
-    khelper->drawColor(&rgb);
+    foreach(KinectHelper* sensor, sensors)
+        sensor->drawCloud();
+    khelper->drawColor();
+    pipeline->decorate();
+}
+
+QVariantMap mode_kinect::statistics(){
+    if(!kstatistics) return QVariantMap(); ///< before the first create()
+    return kstatistics->statistics();
+}
+
+QString mode_kinect::statisticsReport(){
+    if(!kstatistics) return QString();
+    return kstatistics->report();
+}
+
+/// The helper lives in the kinect thread, its slots run there
+bool mode_kinect::startRecording(QString path, bool compress){
+    bool started = false;
+    QMetaObject::invokeMethod(khelper, "startRecording", k_thread ? Qt::BlockingQueuedConnection : Qt::DirectConnection,
+                              Q_RETURN_ARG(bool, started), Q_ARG(QString, path), Q_ARG(bool, compress));
+    return started;
+}
+
+void mode_kinect::stopRecording(){
+    QMetaObject::invokeMethod(khelper, "stopRecording", k_thread ? Qt::BlockingQueuedConnection : Qt::DirectConnection);
+}
+
+void mode_kinect::seek(int frame){
+    QMetaObject::invokeMethod(khelper, "seek", Q_ARG(int, frame));
+}
+
+int mode_kinect::sensorCount(){
+    return sensors.size();
+}
+
+bool mode_kinect::setExtrinsic(int sensor, QVariantList matrix){
+    if(sensor<0 || sensor>=sensors.size() || matrix.size()!=16){
+        qDebug() << "mode_kinect::setExtrinsic: expects a sensor in [0," << sensors.size() << ") and 16 values";
+        return false;
+    }
+    Eigen::Matrix4f pose;
+    for(int i=0; i<16; i++)
+        pose.data()[i] = matrix[i].toFloat();
+    sensors[sensor]->setExtrinsic(pose);
+    return true;
 }
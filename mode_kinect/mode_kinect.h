@@ -1,24 +1,71 @@
 #pragma once
 #include "ModePlugin.h"
 #include "ModePluginDockWidget.h"
+#include "Starlab.h"
 using namespace Starlab;
 
 class KinectHelper;
+class QThreadPool;
+class FramePipeline;
+class KinectStatistics;
+class FusionStage;
 
 class mode_kinect : public ModePlugin{
     Q_OBJECT
     Q_INTERFACES(ModePlugin)
     
+public:
+    mode_kinect();
+    /// Closes the device
+    ~mode_kinect();
+
+private:
     QString name(){ return "Mode Kinect"; }
     QIcon icon(){ return QIcon(":/icons/kinect.png"); }
     bool isApplicable(){  return true; }
     void create();
+    void destroy();
+    void suspend();
+    void resume();
     bool documentChanged(){ return true; }
 
 private:
-    KinectHelper* khelper;
-    QImage rgb;
+    /// Creates the helpers, and opens the devices in the background
+    void create_kinect();
+    KinectHelper* khelper;   ///< primary sensor (first of sensors), lives as long as the plugin
+    QList<KinectHelper*> sensors; ///< every device/recording, drawn together
+    QThread* k_thread;       ///< where the helpers live
+    QThreadPool* acquisition; ///< shared by the helpers for their per-frame work
+    QTimer* timer;           ///< work/repaint, while the mode is active
+    FramePipeline* pipeline; ///< per-frame processing, register stages here
+    FusionStage* fusion;     ///< owned by the pipeline
+    KinectStatistics* kstatistics; ///< timings shown in the dock widget, lives as long as the plugin
+    QTimer* statistics_timer; ///< refreshes them while the mode is active
 public slots:
     void work();   
     void decorate();
+    /// Frames the camera on the scene
+    void fitScene(BBox3 bbox);
+    /// Starts fusing the frames into a new model of the document, or stops
+    void toggleFusion(bool enabled);
+    /// Starts the fused model over
+    void resetFusion();
+
+/// @{ Python console functions, e.g. "mode.statistics()"
+public slots:
+    /// Timings and counters of the acquisition, see KinectStatistics
+    QVariantMap statistics();
+    /// The same, as text
+    QString statisticsReport();
+    /// Records the frames to a file, see KinectHelper::startRecording
+    bool startRecording(QString path, bool compress=true);
+    void stopRecording();
+    /// Jumps to a frame of the .kraw recording being played
+    void seek(int frame);
+    /// Number of sensors (devices or recordings), see KINECT_SOURCE
+    int sensorCount();
+    /// Places a sensor in the scene: 16 values, a column-major 4x4 matrix
+    /// from its coordinates to the scene (the primary sensor, 0, defines them)
+    bool setExtrinsic(int sensor, QVariantList matrix);
+/// @}
 };
@@ -1,9 +1,46 @@
 include($$[STARLAB])
 include($$[OPENNI])
+include($$[SURFACEMESH])
 StarlabTemplate(plugin)
 
 HEADERS += mode_kinect.h \
-    KinectHelper.h
+    KinectHelper.h \
+    DepthUnprojector.h \
+    DepthKernels.h \
+    DepthFilter.h \
+    DepthFilterWidget.h \
+    NormalEstimator.h \
+    PointFrame.h \
+    ColorFrame.h \
+    KinectFrame.h \
+    TripleBuffer.h \
+    SceneBounds.h \
+    FrameSynchronizer.h \
+    RawFrameFile.h \
+    FrameRecorder.h \
+    KinectProfiler.h \
+    FrameStage.h \
+    DecimationStage.h \
+    TsdfVolume.h \
+    FusionStage.h \
+    FramePipeline.h \
+    CloudRenderer.h \
+    GpuCloudRenderer.h
 SOURCES += mode_kinect.cpp \
-    KinectHelper.cpp
+    KinectHelper.cpp \
+    DepthUnprojector.cpp \
+    DepthKernels.cpp \
+    DepthFilter.cpp \
+    DepthFilterWidget.cpp \
+    NormalEstimator.cpp \
+    FrameSynchronizer.cpp \
+    RawFrameFile.cpp \
+    FrameRecorder.cpp \
+    KinectProfiler.cpp \
+    FramePipeline.cpp \
+    DecimationStage.cpp \
+    TsdfVolume.cpp \
+    FusionStage.cpp \
+    CloudRenderer.cpp \
+    GpuCloudRenderer.cpp
 RESOURCES += resources.qrc
@@ -0,0 +1,12 @@
+include($$[STARLAB])
+include($$[OPENNI])
+StarlabTemplate(console)
+
+TARGET = kinect_unprojection_test
+QT += opengl
+
+INCLUDEPATH += ..
+SOURCES += unprojection_test.cpp \
+    ../DepthUnprojector.cpp \
+    ../DepthKernels.cpp \
+    ../GpuCloudRenderer.cpp
@@ -0,0 +1,246 @@
+/// Checks DepthUnprojector against OpenNI: a depth frame of a recording (or of
+/// the sensor) is unprojected with every kernel flavour this CPU supports, and
+/// each point is compared with CoordinateConverter::convertDepthToWorld. The
+/// validity mask and the bounding box are checked on the way.
+/// With --gpu, the vertex shader of GpuCloudRenderer is checked against the
+/// CPU too: the raw frame is drawn into an offscreen buffer through the
+/// projection of the depth camera, so that every point must land on its own
+/// pixel, and the depth buffer must hold the depth of the CPU point.
+/// Exits with 0 if all the flavours agree, 1 otherwise.
+///
+/// usage: kinect_unprojection_test [file.oni] [--frame N] [--tolerance T] [--gpu]
+/// (no file: the first sensor; T: relative error allowed, default 1e-5)
+#include <QApplication>
+#include <QStringList>
+#include <QTextStream>
+#include <QScopedPointer>
+#include <QGLPixelBuffer>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include "OpenNI.h"
+#include "DepthUnprojector.h"
+#include "GpuCloudRenderer.h"
+
+/// Largest error of the flavour over the frame, relative to the depth
+struct Comparison{
+    Comparison() : error(0), mismatches(0), invalid(0), bounds(true){}
+    double error;
+    int mismatches; ///< points farther than the tolerance
+    int invalid;    ///< pixels with a wrong validity flag
+    bool bounds;    ///< is the bounding box the one of the valid points?
+};
+
+static Comparison compare(openni::VideoStream& stream, const openni::DepthPixel* depth, 
+                          const DepthUnprojector& unprojector, double tolerance){
+    int width = unprojector.width(), height = unprojector.height();
+    PointFrame points;
+    points.resize(width, height);
+    unprojector.unproject(depth, points);
+
+    Comparison result;
+    float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for(int y=0; y<height; y++){
+        for(int x=0; x<width; x++){
+            int i = y*width + x;
+            openni::DepthPixel d = depth[i];
+            if(points.valid()[i] != (d ? 1 : 0)) result.invalid++;
+            if(!d) continue;
+
+            float expected[3];
+            openni::CoordinateConverter::convertDepthToWorld(stream, x, y, d, &expected[0], &expected[1], &expected[2]);
+            const float* p = points.xyz() + 3*i;
+            double error = 0;
+            for(int k=0; k<3; k++){
+                error = std::max(error, std::fabs(double(p[k]) - expected[k]) / d);
+                min[k] = std::min(min[k], p[k]);
+                max[k] = std::max(max[k], p[k]);
+            }
+            result.error = std::max(result.error, error);
+            if(error > tolerance) result.mismatches++;
+        }
+    }
+    const float* bounds = points.bounds();
+    for(int k=0; k<3; k++)
+        result.bounds = result.bounds && bounds[k]==min[k] && bounds[3+k]==max[k];
+    return result;
+}
+
+/// Draws the raw frame with GpuCloudRenderer and compares the depth buffer
+/// with the CPU points. x and y are checked to half a pixel (each point must
+/// cover its own pixel), z to the tolerance or to the depth buffer resolution.
+/// Sets skipped if there is no offscreen OpenGL to draw with.
+static Comparison compare_gpu(const openni::DepthPixel* depth, const DepthUnprojector& unprojector,
+                              double tolerance, bool* skipped){
+    int width = unprojector.width(), height = unprojector.height();
+    PointFrame points;
+    points.resize(width, height);
+    unprojector.unproject(depth, points);
+
+    /// What the worker publishes when it leaves the frame to the GPU
+    PointFrame raw;
+    raw.resize(width, height);
+    std::copy(depth, depth + width*height, raw.depth());
+    raw.setIntrinsics(unprojector.xzFactor(), unprojector.yzFactor());
+    raw.setIndex(0);
+
+    Comparison result;
+    *skipped = !QGLPixelBuffer::hasOpenGLPbuffers();
+    if(*skipped) return result;
+    QGLPixelBuffer pbuffer(QSize(width, height), QGLFormat(QGL::DepthBuffer));
+    *skipped = !pbuffer.isValid() || !pbuffer.makeCurrent();
+    if(*skipped) return result;
+
+    /// The frustum of the depth camera, shifted by half a pixel since the
+    /// shader puts pixel x at x/width (the corner of the pixel, not its center)
+    const double zNear = 50, zFar = 65536;
+    glViewport(0, 0, width, height);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glTranslated(1.0/width, -1.0/height, 0);
+    glFrustum(-0.5*zNear*unprojector.xzFactor(), 0.5*zNear*unprojector.xzFactor(),
+              -0.5*zNear*unprojector.yzFactor(), 0.5*zNear*unprojector.yzFactor(), zNear, zFar);
+    /// The camera looks down +z
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glScaled(1, 1, -1);
+    glClearDepth(1);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+    glDisable(GL_POINT_SMOOTH);
+    glPointSize(1);
+    {
+        GpuCloudRenderer renderer;
+        renderer.draw(raw, QImage());
+        glFinish();
+    }
+    std::vector<float> zbuffer(width*height);
+    glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, &zbuffer[0]);
+    GLint bits = 24;
+    glGetIntegerv(GL_DEPTH_BITS, &bits);
+    pbuffer.doneCurrent();
+
+    for(int y=0; y<height; y++){
+        for(int x=0; x<width; x++){
+            int i = y*width + x;
+            openni::DepthPixel d = depth[i];
+            /// Clipped by the near plane
+            if(d && d < zNear) continue;
+            /// Rows of the buffer go bottom up
+            float window = zbuffer[(height-1-y)*width + x];
+            bool covered = window < 1;
+            if(covered != (points.valid()[i] != 0)) result.invalid++;
+            if(!covered || !d) continue;
+
+            double ndc = 2.0*window - 1;
+            double z = 2*zFar*zNear / ((zFar+zNear) - ndc*(zFar-zNear));
+            double error = std::fabs(z - points.xyz()[3*i+2]) / d;
+            /// Relative depth step of the buffer at that depth
+            double step = d * (zFar-zNear) / (zFar*zNear*std::ldexp(1.0, bits));
+            result.error = std::max(result.error, error);
+            if(error > std::max(tolerance, 2*step)) result.mismatches++;
+        }
+    }
+    return result;
+}
+
+int main(int argc, char** argv){
+    /// Offscreen OpenGL wants a GUI application, the CPU checks run without a display
+    bool gpu = false;
+    for(int i=1; i<argc; i++)
+        gpu = gpu || std::string(argv[i])=="--gpu";
+    QScopedPointer<QCoreApplication> app(gpu ? new QApplication(argc, argv) : new QCoreApplication(argc, argv));
+    QStringList args = app->arguments();
+    QString file;
+    int frame = 0;
+    double tolerance = 1e-5;
+    for(int i=1; i<args.size(); i++){
+        if(args[i]=="--frame" && i+1<args.size()) frame = args[++i].toInt();
+        else if(args[i]=="--tolerance" && i+1<args.size()) tolerance = args[++i].toDouble();
+        else if(args[i]=="--gpu") continue;
+        else if(!args[i].startsWith("--") && file.isEmpty()) file = args[i];
+        else { QTextStream(stderr) << "usage: kinect_unprojection_test [file.oni] [--frame N] [--tolerance T] [--gpu]\n"; return 1; }
+    }
+    QTextStream out(stdout);
+
+    /// Open the recording (or the sensor) like KinectHelper does
+    if(openni::OpenNI::initialize() != openni::STATUS_OK){
+        QTextStream(stderr) << "cannot initialize OpenNI: " << openni::OpenNI::getExtendedError() << "\n";
+        return 1;
+    }
+    QByteArray uri = file.toLocal8Bit();
+    openni::Device device;
+    openni::VideoStream stream;
+    if(device.open(file.isEmpty() ? openni::ANY_DEVICE : uri.constData()) != openni::STATUS_OK
+       || stream.create(device, openni::SENSOR_DEPTH) != openni::STATUS_OK
+       || stream.start() != openni::STATUS_OK){
+        QTextStream(stderr) << "cannot open the depth stream: " << openni::OpenNI::getExtendedError() << "\n";
+        openni::OpenNI::shutdown();
+        return 1;
+    }
+    if(device.isFile())
+        device.getPlaybackControl()->setRepeatEnabled(false);
+
+    /// Skip to the frame
+    openni::VideoFrameRef depth;
+    for(int i=0; i<=frame; i++){
+        if(stream.readFrame(&depth) != openni::STATUS_OK){
+            QTextStream(stderr) << "cannot read frame " << i << "\n";
+            openni::OpenNI::shutdown();
+            return 1;
+        }
+    }
+    out << "frame " << depth.getFrameIndex() << ", " << depth.getWidth() << "x" << depth.getHeight() << "\n";
+
+    /// Every flavour, the environment variable is read when the kernels are made
+    bool passed = true;
+    const char* flavours[] = { "scalar", "sse41", "avx2" };
+    for(int f=0; f<3; f++){
+        qputenv("KINECT_SIMD", flavours[f]);
+        DepthUnprojector unprojector;
+        if(std::string(unprojector.kernels.name()) != flavours[f]){
+            out << flavours[f] << ": not supported, skipped\n";
+            continue;
+        }
+        unprojector.setup(stream);
+        if(!unprojector.matches(depth.getWidth(), depth.getHeight())){
+            QTextStream(stderr) << "the frame does not match the video mode of the stream\n";
+            passed = false;
+            break;
+        }
+        Comparison result = compare(stream, (const openni::DepthPixel*) depth.getData(), unprojector, tolerance);
+        bool ok = !result.mismatches && !result.invalid && result.bounds;
+        out << flavours[f] << ": " << (ok ? "ok" : "FAILED")
+            << ", max relative error " << result.error
+            << ", " << result.mismatches << " points off"
+            << ", " << result.invalid << " wrong validity flags"
+            << (result.bounds ? "" : ", wrong bounds") << "\n";
+        passed = passed && ok;
+    }
+
+    /// The shader against the reference flavour
+    if(gpu && passed){
+        qputenv("KINECT_SIMD", "scalar");
+        DepthUnprojector unprojector;
+        unprojector.setup(stream);
+        bool skipped = false;
+        Comparison result = compare_gpu((const openni::DepthPixel*) depth.getData(), unprojector, tolerance, &skipped);
+        if(skipped){
+            out << "gpu: no offscreen OpenGL, skipped\n";
+        } else {
+            bool ok = !result.mismatches && !result.invalid;
+            out << "gpu: " << (ok ? "ok" : "FAILED")
+                << ", max relative error " << result.error
+                << ", " << result.mismatches << " points off"
+                << ", " << result.invalid << " pixels missed or hit\n";
+            passed = ok;
+        }
+    }
+
+    stream.stop();
+    stream.destroy();
+    device.close();
+    openni::OpenNI::shutdown();
+    return passed ? 0 : 1;
+}